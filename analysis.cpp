@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <unordered_map>
+#include <utility>
+
+#include "analysis.h"
+#include "fmt.h"
+
+void collect_callees(ExprAST* node, std::vector<Symbol>& callees) {
+  if (!node) return;
+  switch (node->kind()) {
+    case ExprKind::Literal:
+    case ExprKind::Variable:
+    case ExprKind::Prototype:
+      return;
+    case ExprKind::Prefix:
+      return collect_callees(static_cast<PrefixExprAST*>(node)->operand(),
+                             callees);
+    case ExprKind::Binary:
+      collect_callees(static_cast<BinaryExprAST*>(node)->lhs(), callees);
+      return collect_callees(static_cast<BinaryExprAST*>(node)->rhs(),
+                             callees);
+    case ExprKind::Block:
+      for (ExprAST* expr : static_cast<BlockExprAST*>(node)->exprs()) {
+        collect_callees(expr, callees);
+      }
+      return;
+    case ExprKind::Call:
+      callees.push_back(static_cast<CallExprAST*>(node)->callee());
+      for (ExprAST* arg : static_cast<CallExprAST*>(node)->args()) {
+        collect_callees(arg, callees);
+      }
+      return;
+    case ExprKind::Function:
+      return collect_callees(static_cast<FunctionAST*>(node)->body(),
+                             callees);
+    case ExprKind::Let:
+      return collect_callees(static_cast<LetExprAST*>(node)->expr(),
+                             callees);
+    case ExprKind::If: {
+      auto if_expr = static_cast<IfExprAST*>(node);
+      collect_callees(if_expr->condition(), callees);
+      collect_callees(if_expr->then_expr(), callees);
+      return collect_callees(if_expr->else_expr(), callees);
+    }
+    case ExprKind::Loop: {
+      auto loop = static_cast<LoopExprAST*>(node);
+      collect_callees(loop->init(), callees);
+      collect_callees(loop->condition(), callees);
+      collect_callees(loop->step(), callees);
+      return collect_callees(loop->body(), callees);
+    }
+    case ExprKind::Array:
+      return;
+    case ExprKind::Index:
+      return collect_callees(static_cast<IndexExprAST*>(node)->index(),
+                             callees);
+  }
+}
+
+// whether node indexes an array or declares one
+static bool indexes_arrays(ExprAST* node) {
+  if (!node) return false;
+  switch (node->kind()) {
+    case ExprKind::Literal:
+    case ExprKind::Variable:
+    case ExprKind::Prototype:
+      return false;
+    case ExprKind::Prefix:
+      return indexes_arrays(static_cast<PrefixExprAST*>(node)->operand());
+    case ExprKind::Binary:
+      return indexes_arrays(static_cast<BinaryExprAST*>(node)->lhs()) ||
+             indexes_arrays(static_cast<BinaryExprAST*>(node)->rhs());
+    case ExprKind::Block:
+      return std::ranges::any_of(static_cast<BlockExprAST*>(node)->exprs(),
+                                 indexes_arrays);
+    case ExprKind::Call:
+      return std::ranges::any_of(static_cast<CallExprAST*>(node)->args(),
+                                 indexes_arrays);
+    case ExprKind::Function:
+      return static_cast<FunctionAST*>(node)->prototype()->has_array_args() ||
+             indexes_arrays(static_cast<FunctionAST*>(node)->body());
+    case ExprKind::Let:
+      return indexes_arrays(static_cast<LetExprAST*>(node)->expr());
+    case ExprKind::If: {
+      auto if_expr = static_cast<IfExprAST*>(node);
+      return indexes_arrays(if_expr->condition()) ||
+             indexes_arrays(if_expr->then_expr()) ||
+             indexes_arrays(if_expr->else_expr());
+    }
+    case ExprKind::Loop: {
+      auto loop = static_cast<LoopExprAST*>(node);
+      return indexes_arrays(loop->init()) ||
+             indexes_arrays(loop->condition()) ||
+             indexes_arrays(loop->step()) || indexes_arrays(loop->body());
+    }
+    case ExprKind::Array:
+    case ExprKind::Index:
+      return true;
+  }
+  return false;
+}
+
+bool uses_arrays(std::span<ExprAST* const> items) {
+  return std::ranges::any_of(items, indexes_arrays);
+}
+
+bool uses_arrays(ExprAST* item) {
+  return indexes_arrays(item);
+}
+
+FunctionFacts analyze_functions(std::span<ExprAST* const> items) {
+  std::vector<FunctionAST*> functions;
+  std::unordered_map<Symbol, size_t> indices;
+  for (ExprAST* item : items) {
+    if (item->kind() != ExprKind::Function) continue;
+    auto function = static_cast<FunctionAST*>(item);
+    if (indices.try_emplace(function->prototype()->name(), functions.size())
+            .second)
+      functions.push_back(function);
+  }
+  size_t count = functions.size();
+  // calls to defined functions become edges, any other call is impure
+  std::vector<std::vector<size_t>> edges(count);
+  std::vector<bool> pure(count, true);
+  std::vector<Symbol> callees;
+  for (size_t i = 0; i < count; ++i) {
+    // arrays are memory, which may outlive the call or be shared with it
+    if (indexes_arrays(functions[i])) pure[i] = false;
+    callees.clear();
+    collect_callees(functions[i], callees);
+    for (Symbol callee : callees) {
+      auto it = indices.find(callee);
+      if (it == indices.end()) {
+        pure[i] = false;
+      } else {
+        edges[i].push_back(it->second);
+      }
+    }
+  }
+
+  // Tarjan's strongly connected components, iterative so that long call
+  // chains do not overflow the stack. Components complete callees first,
+  // so impurity propagates to callers in the same sweep.
+  FunctionFacts facts;
+  std::vector<size_t> order(count, SIZE_MAX), low(count);
+  std::vector<bool> on_stack(count);
+  std::vector<size_t> stack;
+  // node and the next edge to follow
+  std::vector<std::pair<size_t, size_t>> work;
+  size_t counter = 0;
+  for (size_t root = 0; root < count; ++root) {
+    if (order[root] != SIZE_MAX) continue;
+    work.emplace_back(root, 0);
+    while (!work.empty()) {
+      auto [node, edge] = work.back();
+      if (edge == 0 && order[node] == SIZE_MAX) {
+        order[node] = low[node] = counter++;
+        stack.push_back(node);
+        on_stack[node] = true;
+      }
+      if (edge < edges[node].size()) {
+        ++work.back().second;
+        size_t callee = edges[node][edge];
+        if (order[callee] == SIZE_MAX) {
+          work.emplace_back(callee, 0);
+        } else if (on_stack[callee]) {
+          low[node] = std::min(low[node], order[callee]);
+        }
+        continue;
+      }
+      work.pop_back();
+      if (!work.empty()) {
+        size_t caller = work.back().first;
+        low[caller] = std::min(low[caller], low[node]);
+      }
+      if (low[node] != order[node]) continue;
+      // the root sits near the top, searching from the bottom is quadratic
+      auto first = std::find(stack.rbegin(), stack.rend(), node).base() - 1;
+      std::span component(first, stack.end());
+      bool component_pure = true;
+      for (size_t member : component) {
+        component_pure = component_pure && pure[member];
+        for (size_t callee : edges[member]) {
+          // callees outside the component are already final
+          component_pure = component_pure && pure[callee];
+        }
+      }
+      bool recursive =
+          component.size() > 1 ||
+          std::ranges::find(edges[node], node) != edges[node].end();
+      for (size_t member : component) {
+        pure[member] = component_pure;
+        on_stack[member] = false;
+        Symbol name = functions[member]->prototype()->name();
+        if (component_pure) facts.pure.insert(name);
+        if (recursive) facts.recursive.insert(name);
+      }
+      stack.erase(first, stack.end());
+    }
+  }
+  return facts;
+}
+
+void select_memoized(std::span<ExprAST* const> items, bool automatic) {
+  FunctionFacts facts = analyze_functions(items);
+  for (ExprAST* item : items) {
+    if (item->kind() != ExprKind::Function) continue;
+    auto function = static_cast<FunctionAST*>(item);
+    Symbol name = function->prototype()->name();
+    if (function->memoize() && !facts.pure.contains(name))
+      error("@memo function %s is not pure, it may call an extern or use "
+            "an array",
+            name.str().c_str());
+    if (automatic && facts.pure.contains(name) &&
+        facts.recursive.contains(name) &&
+        !function->prototype()->args().empty())
+      function->set_memoize(true);
+  }
+}
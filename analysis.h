@@ -0,0 +1,30 @@
+#pragma once
+
+#include <span>
+#include <unordered_set>
+#include <vector>
+
+#include "ast.h"
+
+// Facts about the defined functions of a program, from its call graph.
+struct FunctionFacts {
+  // reach neither an extern, an undefined function nor an array, so
+  // results depend on the arguments alone
+  std::unordered_set<Symbol> pure;
+  // on a call cycle, directly or through other functions
+  std::unordered_set<Symbol> recursive;
+};
+
+FunctionFacts analyze_functions(std::span<ExprAST* const> items);
+
+// Checks that @memo functions are pure and, if automatic, marks every pure
+// recursive function with arguments for memoization too.
+void select_memoized(std::span<ExprAST* const> items, bool automatic);
+
+// whether the program declares or indexes arrays, which only compiled code
+// supports
+bool uses_arrays(std::span<ExprAST* const> items);
+bool uses_arrays(ExprAST* item);
+
+// appends the callee of every call in node
+void collect_callees(ExprAST* node, std::vector<Symbol>& callees);
@@ -14,156 +14,184 @@ int LiteralExprAST::value() const {
   return value_;
 }
 
-void LiteralExprAST::accept(ASTNodeVisitor& visitor) {
-  visitor.visitLiteralNode(this);
-}
-
-VariableExprAST::VariableExprAST(const std::string& name)
+VariableExprAST::VariableExprAST(Symbol name)
     : ExprAST{ExprKind::Variable}, name_{name} {}
 
-const std::string& VariableExprAST::name() const {
+Symbol VariableExprAST::name() const {
   return name_;
 }
 
-void VariableExprAST::accept(ASTNodeVisitor& visitor) {
-  visitor.visitVariableNode(this);
-}
-
-PrefixExprAST::PrefixExprAST(Token::Kind op, std::unique_ptr<ExprAST> operand)
-    : ExprAST{ExprKind::Prefix}, op_{op}, operand_{std::move(operand)} {}
+PrefixExprAST::PrefixExprAST(Token::Kind op, ExprAST* operand)
+    : ExprAST{ExprKind::Prefix}, op_{op}, operand_{operand} {}
 
 Token::Kind PrefixExprAST::op() const {
   return op_;
 }
 
-std::unique_ptr<ExprAST>& PrefixExprAST::operand() {
+ExprAST*& PrefixExprAST::operand() {
   return operand_;
 }
 
-void PrefixExprAST::accept(ASTNodeVisitor& visitor) {
-  visitor.visitPrefixNode(this);
-}
-
-BinaryExprAST::BinaryExprAST(Token::Kind op,
-                             std::unique_ptr<ExprAST> lhs,
-                             std::unique_ptr<ExprAST> rhs)
-    : ExprAST{ExprKind::Binary},
-      op_{op},
-      lhs_{std::move(lhs)},
-      rhs_{std::move(rhs)} {}
+BinaryExprAST::BinaryExprAST(Token::Kind op, ExprAST* lhs, ExprAST* rhs)
+    : ExprAST{ExprKind::Binary}, op_{op}, lhs_{lhs}, rhs_{rhs} {}
 
 Token::Kind BinaryExprAST::op() const {
   return op_;
 }
 
-std::unique_ptr<ExprAST>& BinaryExprAST::lhs() {
+ExprAST*& BinaryExprAST::lhs() {
   return lhs_;
 }
 
-std::unique_ptr<ExprAST>& BinaryExprAST::rhs() {
+ExprAST*& BinaryExprAST::rhs() {
   return rhs_;
 }
 
-void BinaryExprAST::accept(ASTNodeVisitor& visitor) {
-  visitor.visitBinaryNode(this);
-}
-
-BlockExprAST::BlockExprAST(std::vector<std::unique_ptr<ExprAST>>&& exprs)
-    : ExprAST{ExprKind::Block}, exprs_{std::move(exprs)} {}
+BlockExprAST::BlockExprAST(std::span<ExprAST*> exprs)
+    : ExprAST{ExprKind::Block}, exprs_{exprs} {}
 
-std::vector<std::unique_ptr<ExprAST>>& BlockExprAST::exprs() {
+std::span<ExprAST*> BlockExprAST::exprs() {
   return exprs_;
 }
 
-void BlockExprAST::accept(ASTNodeVisitor& visitor) {
-  visitor.visitBlockNode(this);
+bool is_empty_block(ExprAST* node) {
+  return node->kind() == ExprKind::Block &&
+         static_cast<BlockExprAST*>(node)->exprs().empty();
 }
 
-CallExprAST::CallExprAST(const std::string& callee,
-                         std::vector<std::unique_ptr<ExprAST>> args)
-    : ExprAST{ExprKind::Call}, callee_{callee}, args_{std::move(args)} {}
+CallExprAST::CallExprAST(Symbol callee, std::span<ExprAST*> args)
+    : ExprAST{ExprKind::Call}, callee_{callee}, args_{args} {}
 
-const std::string& CallExprAST::callee() const {
+Symbol CallExprAST::callee() const {
   return callee_;
 }
 
-std::vector<std::unique_ptr<ExprAST>>& CallExprAST::args() {
+std::span<ExprAST*> CallExprAST::args() {
   return args_;
 }
 
-void CallExprAST::accept(ASTNodeVisitor& visitor) {
-  visitor.visitCallNode(this);
-}
-
-PrototypeAST::PrototypeAST(const std::string& name,
-                           std::vector<std::string> args)
-    : ExprAST{ExprKind::Prototype}, name_{name}, args_{std::move(args)} {}
+PrototypeAST::PrototypeAST(Symbol name,
+                           std::span<Symbol> args,
+                           std::span<uint32_t> array_sizes)
+    : ExprAST{ExprKind::Prototype},
+      name_{name},
+      args_{args},
+      array_sizes_{array_sizes} {}
 
-const std::string& PrototypeAST::name() const {
+Symbol PrototypeAST::name() const {
   return name_;
 }
 
-const std::vector<std::string>& PrototypeAST::args() const {
+std::span<Symbol> PrototypeAST::args() const {
   return args_;
 }
 
-void PrototypeAST::accept(ASTNodeVisitor& visitor) {
-  visitor.visitPrototypeNode(this);
+uint32_t PrototypeAST::array_size(size_t i) const {
+  return array_sizes_.empty() ? 0 : array_sizes_[i];
 }
 
-FunctionAST::FunctionAST(std::unique_ptr<PrototypeAST> prototype,
-                         std::unique_ptr<ExprAST> body)
-    : ExprAST{ExprKind::Function},
-      prototype_{std::move(prototype)},
-      body_{std::move(body)} {}
+bool PrototypeAST::has_array_args() const {
+  return !array_sizes_.empty();
+}
+
+FunctionAST::FunctionAST(PrototypeAST* prototype, ExprAST* body)
+    : ExprAST{ExprKind::Function}, prototype_{prototype}, body_{body} {}
 
-std::unique_ptr<PrototypeAST>& FunctionAST::prototype() {
+PrototypeAST*& FunctionAST::prototype() {
   return prototype_;
 }
 
-std::unique_ptr<ExprAST>& FunctionAST::body() {
+ExprAST*& FunctionAST::body() {
   return body_;
 }
 
-void FunctionAST::accept(ASTNodeVisitor& visitor) {
-  visitor.visitFunctionNode(this);
+bool FunctionAST::memoize() const {
+  return memoize_;
 }
 
-LetExprAST::LetExprAST(const std::string& name, std::unique_ptr<ExprAST> expr)
-    : ExprAST{ExprKind::Let}, name_{name}, expr_{std::move(expr)} {}
+void FunctionAST::set_memoize(bool memoize) {
+  memoize_ = memoize;
+}
 
-const std::string& LetExprAST::name() const {
+LetExprAST::LetExprAST(Symbol name, ExprAST* expr)
+    : ExprAST{ExprKind::Let}, name_{name}, expr_{expr} {}
+
+Symbol LetExprAST::name() const {
   return name_;
 }
 
-std::unique_ptr<ExprAST>& LetExprAST::expr() {
+ExprAST*& LetExprAST::expr() {
   return expr_;
 }
 
-void LetExprAST::accept(ASTNodeVisitor& visitor) {
-  visitor.visitLetNode(this);
-}
-
-IfExprAST::IfExprAST(std::unique_ptr<ExprAST> condition,
-                     std::unique_ptr<ExprAST> then_expr,
-                     std::unique_ptr<ExprAST> else_expr)
+IfExprAST::IfExprAST(ExprAST* condition,
+                     ExprAST* then_expr,
+                     ExprAST* else_expr)
     : ExprAST{ExprKind::If},
-      condition_{std::move(condition)},
-      then_expr_{std::move(then_expr)},
-      else_expr_{std::move(else_expr)} {}
+      condition_{condition},
+      then_expr_{then_expr},
+      else_expr_{else_expr} {}
 
-std::unique_ptr<ExprAST>& IfExprAST::condition() {
+ExprAST*& IfExprAST::condition() {
   return condition_;
 }
 
-std::unique_ptr<ExprAST>& IfExprAST::then_expr() {
+ExprAST*& IfExprAST::then_expr() {
   return then_expr_;
 }
 
-std::unique_ptr<ExprAST>& IfExprAST::else_expr() {
+ExprAST*& IfExprAST::else_expr() {
   return else_expr_;
 }
 
-void IfExprAST::accept(ASTNodeVisitor& visitor) {
-  visitor.visitIfNode(this);
+LoopExprAST::LoopExprAST(ExprAST* init,
+                         ExprAST* condition,
+                         ExprAST* step,
+                         ExprAST* body)
+    : ExprAST{ExprKind::Loop},
+      init_{init},
+      condition_{condition},
+      step_{step},
+      body_{body} {}
+
+ExprAST*& LoopExprAST::init() {
+  return init_;
+}
+
+ExprAST*& LoopExprAST::condition() {
+  return condition_;
+}
+
+ExprAST*& LoopExprAST::step() {
+  return step_;
+}
+
+ExprAST*& LoopExprAST::body() {
+  return body_;
+}
+
+ArrayExprAST::ArrayExprAST(Symbol name, uint32_t size, bool global)
+    : ExprAST{ExprKind::Array}, name_{name}, size_{size}, global_{global} {}
+
+Symbol ArrayExprAST::name() const {
+  return name_;
+}
+
+uint32_t ArrayExprAST::size() const {
+  return size_;
+}
+
+bool ArrayExprAST::global() const {
+  return global_;
+}
+
+IndexExprAST::IndexExprAST(Symbol array, ExprAST* index)
+    : ExprAST{ExprKind::Index}, array_{array}, index_{index} {}
+
+Symbol IndexExprAST::array() const {
+  return array_;
+}
+
+ExprAST*& IndexExprAST::index() {
+  return index_;
 }
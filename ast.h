@@ -1,7 +1,7 @@
 #pragma once
 
-#include <memory>
-#include <vector>
+#include <cstdint>
+#include <span>
 
 #include "token.h"
 
@@ -15,18 +15,19 @@ enum class ExprKind {
   Prototype,
   Function,
   Let,
-  If
+  If,
+  Loop,
+  Array,
+  Index
 };
 
-class ASTNodeVisitor;
-
+// Nodes are allocated in an ASTContext and never destroyed individually, so
+// they must stay trivially destructible.
 class ExprAST {
  public:
   ExprAST(ExprKind kind);
-  virtual ~ExprAST() = default;
 
   ExprKind kind() const;
-  virtual void accept(ASTNodeVisitor& visitor) = 0;
 
  private:
   ExprKind kind_;
@@ -38,151 +39,209 @@ class LiteralExprAST : public ExprAST {
 
   int value() const;
 
-  void accept(ASTNodeVisitor& visitor) override;
-
  private:
   int value_;
 };
 
 class VariableExprAST : public ExprAST {
  public:
-  VariableExprAST(const std::string& name);
+  VariableExprAST(Symbol name);
 
-  const std::string& name() const;
-
-  void accept(ASTNodeVisitor& visitor) override;
+  Symbol name() const;
 
  private:
-  std::string name_;
+  Symbol name_;
 };
 
 class PrefixExprAST : public ExprAST {
  public:
-  PrefixExprAST(Token::Kind op, std::unique_ptr<ExprAST> operand);
+  PrefixExprAST(Token::Kind op, ExprAST* operand);
 
   Token::Kind op() const;
-  std::unique_ptr<ExprAST>& operand();
-
-  void accept(ASTNodeVisitor& visitor) override;
+  ExprAST*& operand();
 
  private:
   Token::Kind op_;
-  std::unique_ptr<ExprAST> operand_;
+  ExprAST* operand_;
 };
 
 class BinaryExprAST : public ExprAST {
  public:
-  BinaryExprAST(Token::Kind op,
-                std::unique_ptr<ExprAST> lhs,
-                std::unique_ptr<ExprAST> rhs);
+  BinaryExprAST(Token::Kind op, ExprAST* lhs, ExprAST* rhs);
 
   Token::Kind op() const;
-  std::unique_ptr<ExprAST>& lhs();
-  std::unique_ptr<ExprAST>& rhs();
-
-  void accept(ASTNodeVisitor& visitor) override;
+  ExprAST*& lhs();
+  ExprAST*& rhs();
 
  private:
   Token::Kind op_;
-  std::unique_ptr<ExprAST> lhs_, rhs_;
+  ExprAST *lhs_, *rhs_;
 };
 
 class BlockExprAST : public ExprAST {
  public:
-  BlockExprAST(std::vector<std::unique_ptr<ExprAST>>&& exprs);
-
-  std::vector<std::unique_ptr<ExprAST>>& exprs();
+  BlockExprAST(std::span<ExprAST*> exprs);
 
-  void accept(ASTNodeVisitor& visitor) override;
+  std::span<ExprAST*> exprs();
 
  private:
-  std::vector<std::unique_ptr<ExprAST>> exprs_;
+  std::span<ExprAST*> exprs_;
 };
 
+// `{}`, which has no value; loop bodies may be empty, their value is unused
+bool is_empty_block(ExprAST* node);
+
 class CallExprAST : public ExprAST {
  public:
-  CallExprAST(const std::string& callee,
-              std::vector<std::unique_ptr<ExprAST>> args);
+  CallExprAST(Symbol callee, std::span<ExprAST*> args);
 
-  const std::string& callee() const;
-  std::vector<std::unique_ptr<ExprAST>>& args();
-
-  void accept(ASTNodeVisitor& visitor) override;
+  Symbol callee() const;
+  std::span<ExprAST*> args();
 
  private:
-  std::string callee_;
-  std::vector<std::unique_ptr<ExprAST>> args_;
+  Symbol callee_;
+  std::span<ExprAST*> args_;
 };
 
 class PrototypeAST : public ExprAST {
  public:
-  PrototypeAST(const std::string& name, std::vector<std::string> args);
-
-  const std::string& name() const;
-  const std::vector<std::string>& args() const;
+  // array_sizes is empty, or has the size of each array argument and 0 for
+  // the others
+  PrototypeAST(Symbol name, std::span<Symbol> args,
+               std::span<uint32_t> array_sizes = {});
 
-  void accept(ASTNodeVisitor& visitor) override;
+  Symbol name() const;
+  std::span<Symbol> args() const;
+  // elements of argument i if it is an array, else 0
+  uint32_t array_size(size_t i) const;
+  bool has_array_args() const;
 
  private:
-  std::string name_;
-  std::vector<std::string> args_;
+  Symbol name_;
+  std::span<Symbol> args_;
+  std::span<uint32_t> array_sizes_;
 };
 
 class FunctionAST : public ExprAST {
  public:
-  FunctionAST(std::unique_ptr<PrototypeAST> prototype,
-              std::unique_ptr<ExprAST> body);
+  FunctionAST(PrototypeAST* prototype, ExprAST* body);
 
-  std::unique_ptr<PrototypeAST>& prototype();
-  std::unique_ptr<ExprAST>& body();
-
-  void accept(ASTNodeVisitor& visitor) override;
+  PrototypeAST*& prototype();
+  ExprAST*& body();
+  // compiled with a table of previous results, set by @memo or --auto-memo
+  bool memoize() const;
+  void set_memoize(bool memoize);
 
  private:
-  std::unique_ptr<PrototypeAST> prototype_;
-  std::unique_ptr<ExprAST> body_;
+  PrototypeAST* prototype_;
+  ExprAST* body_;
+  bool memoize_ = false;
 };
 
 class LetExprAST : public ExprAST {
  public:
-  LetExprAST(const std::string& name, std::unique_ptr<ExprAST> expr);
-
-  const std::string& name() const;
-  std::unique_ptr<ExprAST>& expr();
+  LetExprAST(Symbol name, ExprAST* expr);
 
-  void accept(ASTNodeVisitor& visitor) override;
+  Symbol name() const;
+  ExprAST*& expr();
 
  private:
-  std::string name_;
-  std::unique_ptr<ExprAST> expr_;
+  Symbol name_;
+  ExprAST* expr_;
 };
 
 class IfExprAST : public ExprAST {
  public:
-  IfExprAST(std::unique_ptr<ExprAST> condition,
-            std::unique_ptr<ExprAST> then_expr,
-            std::unique_ptr<ExprAST> else_expr);
+  IfExprAST(ExprAST* condition, ExprAST* then_expr, ExprAST* else_expr);
+
+  ExprAST*& condition();
+  ExprAST*& then_expr();
+  ExprAST*& else_expr();
+
+ private:
+  ExprAST *condition_, *then_expr_, *else_expr_;
+};
+
+// while and for loops. init runs once, in the loop's scope; condition and
+// step run around every iteration of body. Any of init, condition and step
+// may be null, a null condition loops forever. The value is 0.
+class LoopExprAST : public ExprAST {
+ public:
+  LoopExprAST(ExprAST* init, ExprAST* condition, ExprAST* step, ExprAST* body);
+
+  ExprAST*& init();
+  ExprAST*& condition();
+  ExprAST*& step();
+  ExprAST*& body();
+
+ private:
+  ExprAST *init_, *condition_, *step_, *body_;
+};
+
+// `let name[size];`, a zeroed array of i32. Global ones are top level items.
+class ArrayExprAST : public ExprAST {
+ public:
+  ArrayExprAST(Symbol name, uint32_t size, bool global);
 
-  std::unique_ptr<ExprAST>& condition();
-  std::unique_ptr<ExprAST>& then_expr();
-  std::unique_ptr<ExprAST>& else_expr();
+  Symbol name() const;
+  uint32_t size() const;
+  bool global() const;
+
+ private:
+  Symbol name_;
+  uint32_t size_;
+  bool global_;
+};
+
+// `array[index]`, an element as a value or the left hand side of `=`
+class IndexExprAST : public ExprAST {
+ public:
+  IndexExprAST(Symbol array, ExprAST* index);
 
-  void accept(ASTNodeVisitor& visitor) override;
+  Symbol array() const;
+  ExprAST*& index();
 
  private:
-  std::unique_ptr<ExprAST> condition_, then_expr_, else_expr_;
+  Symbol array_;
+  ExprAST* index_;
 };
 
-class ASTNodeVisitor {
+// Static visitor: visitNode switches on the node kind and calls the
+// matching Derived::visitXNode directly, so walks can inline and each visit
+// returns a typed Result.
+template <typename Derived, typename Result = void>
+class ASTVisitor {
  public:
-  virtual void visitLiteralNode(LiteralExprAST* node) = 0;
-  virtual void visitVariableNode(VariableExprAST* node) = 0;
-  virtual void visitPrefixNode(PrefixExprAST* node) = 0;
-  virtual void visitBinaryNode(BinaryExprAST* node) = 0;
-  virtual void visitBlockNode(BlockExprAST* node) = 0;
-  virtual void visitCallNode(CallExprAST* node) = 0;
-  virtual void visitPrototypeNode(PrototypeAST* node) = 0;
-  virtual void visitFunctionNode(FunctionAST* node) = 0;
-  virtual void visitLetNode(LetExprAST* node) = 0;
-  virtual void visitIfNode(IfExprAST* node) = 0;
+  Result visitNode(ExprAST* node) {
+    Derived& self = static_cast<Derived&>(*this);
+    switch (node->kind()) {
+      case ExprKind::Literal:
+        return self.visitLiteralNode(static_cast<LiteralExprAST*>(node));
+      case ExprKind::Variable:
+        return self.visitVariableNode(static_cast<VariableExprAST*>(node));
+      case ExprKind::Prefix:
+        return self.visitPrefixNode(static_cast<PrefixExprAST*>(node));
+      case ExprKind::Binary:
+        return self.visitBinaryNode(static_cast<BinaryExprAST*>(node));
+      case ExprKind::Block:
+        return self.visitBlockNode(static_cast<BlockExprAST*>(node));
+      case ExprKind::Call:
+        return self.visitCallNode(static_cast<CallExprAST*>(node));
+      case ExprKind::Prototype:
+        return self.visitPrototypeNode(static_cast<PrototypeAST*>(node));
+      case ExprKind::Function:
+        return self.visitFunctionNode(static_cast<FunctionAST*>(node));
+      case ExprKind::Let:
+        return self.visitLetNode(static_cast<LetExprAST*>(node));
+      case ExprKind::If:
+        return self.visitIfNode(static_cast<IfExprAST*>(node));
+      case ExprKind::Loop:
+        return self.visitLoopNode(static_cast<LoopExprAST*>(node));
+      case ExprKind::Array:
+        return self.visitArrayNode(static_cast<ArrayExprAST*>(node));
+      case ExprKind::Index:
+        return self.visitIndexNode(static_cast<IndexExprAST*>(node));
+    }
+    __builtin_unreachable();
+  }
 };
@@ -0,0 +1,47 @@
+#include <cstdlib>
+
+#include "astcontext.h"
+
+ASTContext::ASTContext()
+    : own_symbols_{std::make_unique<SymbolTable>()},
+      symbols_{own_symbols_.get()} {}
+
+ASTContext::ASTContext(SymbolTable& symbols) : symbols_{&symbols} {}
+
+ASTContext::~ASTContext() {
+  for (char* slab : slabs_) free(slab);
+}
+
+size_t ASTContext::bytes_allocated() const {
+  return bytes_allocated_;
+}
+
+SymbolTable& ASTContext::symbols() {
+  return *symbols_;
+}
+
+void ASTContext::adopt(ASTContext& other) {
+  slabs_.insert(slabs_.end(), other.slabs_.begin(), other.slabs_.end());
+  bytes_allocated_ += other.bytes_allocated_;
+  other.slabs_.clear();
+  other.cur_ = other.end_ = nullptr;
+  other.bytes_allocated_ = 0;
+}
+
+void* ASTContext::allocate_slow(size_t size, size_t align) {
+  // oversized requests get a slab of their own, keeping the current one
+  if (size + align > slab_size / 2) {
+    char* slab = static_cast<char*>(malloc(size + align));
+    if (!slab) throw std::bad_alloc();
+    slabs_.push_back(slab);
+    bytes_allocated_ += size;
+    return reinterpret_cast<void*>(
+        align_up(reinterpret_cast<uintptr_t>(slab), align));
+  }
+  char* slab = static_cast<char*>(malloc(slab_size));
+  if (!slab) throw std::bad_alloc();
+  slabs_.push_back(slab);
+  cur_ = slab;
+  end_ = slab + slab_size;
+  return allocate(size, align);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "symbol.h"
+
+// Bump allocator owning every AST node of a compilation unit, and the
+// symbols its names are interned into. Nodes are never destroyed one by
+// one: the whole tree is released with the context, without walking it, so
+// even degenerate trees are freed without recursion.
+class ASTContext {
+ public:
+  ASTContext();
+  // interns into symbols, which must outlive the context, instead of a
+  // table of its own
+  explicit ASTContext(SymbolTable& symbols);
+  ~ASTContext();
+
+  ASTContext(const ASTContext&) = delete;
+  ASTContext& operator=(const ASTContext&) = delete;
+
+  template <typename T, typename... Args>
+  T* make(Args&&... args) {
+    static_assert(std::is_trivially_destructible_v<T>,
+                  "arena objects are freed without running destructors");
+    return new (allocate(sizeof(T), alignof(T)))
+        T(std::forward<Args>(args)...);
+  }
+
+  // copies items into the arena
+  template <typename T>
+  std::span<T> make_array(std::span<const T> items) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    if (items.empty()) return {};
+    T* data = static_cast<T*>(allocate(items.size_bytes(), alignof(T)));
+    std::uninitialized_copy(items.begin(), items.end(), data);
+    return {data, items.size()};
+  }
+
+  void* allocate(size_t size, size_t align) {
+    uintptr_t p = align_up(reinterpret_cast<uintptr_t>(cur_), align);
+    if (p + size > reinterpret_cast<uintptr_t>(end_))
+      return allocate_slow(size, align);
+    cur_ = reinterpret_cast<char*>(p + size);
+    bytes_allocated_ += size;
+    return reinterpret_cast<void*>(p);
+  }
+
+  size_t bytes_allocated() const;
+  SymbolTable& symbols();
+
+  // takes over the nodes of other, which is left empty; their names must
+  // be interned into symbols()
+  void adopt(ASTContext& other);
+
+ private:
+  static constexpr size_t slab_size = 64 * 1024;
+
+  std::unique_ptr<SymbolTable> own_symbols_;
+  SymbolTable* symbols_;
+  std::vector<char*> slabs_;
+  char* cur_{nullptr};
+  char* end_{nullptr};
+  size_t bytes_allocated_{0};
+
+  static uintptr_t align_up(uintptr_t p, size_t align) {
+    return (p + align - 1) & ~(align - 1);
+  }
+
+  void* allocate_slow(size_t size, size_t align);
+};
@@ -2,10 +2,6 @@
 
 ASTPrinter::ASTPrinter() {}
 
-void ASTPrinter::visitNode(ExprAST* node) {
-  node->accept(*this);
-}
-
 void ASTPrinter::visitLiteralNode(LiteralExprAST* node) {
   os_ << node->value();
 }
@@ -16,14 +12,14 @@ void ASTPrinter::visitVariableNode(VariableExprAST* node) {
 
 void ASTPrinter::visitPrefixNode(PrefixExprAST* node) {
   os_ << Token(node->op());
-  visitNode(node->operand().get());
+  visitNode(node->operand());
 }
 
 void ASTPrinter::visitBinaryNode(BinaryExprAST* node) {
   os_ << "(";
-  visitNode(node->lhs().get());
+  visitNode(node->lhs());
   os_ << " " << Token(node->op()) << " ";
-  visitNode(node->rhs().get());
+  visitNode(node->rhs());
   os_ << ")";
 }
 
@@ -31,7 +27,7 @@ void ASTPrinter::visitBlockNode(BlockExprAST* node) {
   indent();
   os_ << "{" << std::endl;
   for (size_t i = 0; i < node->exprs().size(); ++i) {
-    visitNode(node->exprs()[i].get());
+    visitNode(node->exprs()[i]);
     if (i + 1 == node->exprs().size()) dedent();
     os_ << std::endl;
   }
@@ -42,7 +38,7 @@ void ASTPrinter::visitCallNode(CallExprAST* node) {
   os_ << node->callee() << "(";
   for (size_t i = 0; i < node->args().size(); ++i) {
     if (i > 0) os_ << ", ";
-    visitNode(node->args()[i].get());
+    visitNode(node->args()[i]);
   }
   os_ << ")";
 }
@@ -52,31 +48,64 @@ void ASTPrinter::visitPrototypeNode(PrototypeAST* node) {
   for (size_t i = 0; i < node->args().size(); ++i) {
     if (i > 0) os_ << ", ";
     os_ << node->args()[i];
+    if (node->array_size(i)) os_ << "[" << node->array_size(i) << "]";
   }
   os_ << ")";
 }
 
 void ASTPrinter::visitFunctionNode(FunctionAST* node) {
+  if (node->memoize()) os_ << "@memo ";
   os_ << Token(Token::Kind::Def) << " ";
-  visitNode(node->prototype().get());
+  visitNode(node->prototype());
   os_ << " ";
-  visitNode(node->body().get());
+  visitNode(node->body());
 }
 
 void ASTPrinter::visitLetNode(LetExprAST* node) {
   os_ << Token(Token::Kind::Let) << " " << node->name() << " = ";
-  visitNode(node->expr().get());
+  visitNode(node->expr());
 }
 
 void ASTPrinter::visitIfNode(IfExprAST* node) {
   os_ << Token(Token::Kind::If) << " (";
-  visitNode(node->condition().get());
+  visitNode(node->condition());
   os_ << ") ";
-  visitNode(node->then_expr().get());
+  visitNode(node->then_expr());
   if (node->else_expr()) {
     os_ << " " << Token(Token::Kind::Else) << " ";
-    visitNode(node->else_expr().get());
+    visitNode(node->else_expr());
+  }
+}
+
+void ASTPrinter::visitLoopNode(LoopExprAST* node) {
+  if (node->init() || node->step()) {
+    os_ << Token(Token::Kind::For) << " (";
+    if (node->init()) visitNode(node->init());
+    os_ << "; ";
+    if (node->condition()) visitNode(node->condition());
+    os_ << "; ";
+    if (node->step()) visitNode(node->step());
+  } else {
+    os_ << Token(Token::Kind::While) << " (";
+    if (node->condition()) {
+      visitNode(node->condition());
+    } else {
+      os_ << 1;
+    }
   }
+  os_ << ") ";
+  visitNode(node->body());
+}
+
+void ASTPrinter::visitArrayNode(ArrayExprAST* node) {
+  os_ << Token(Token::Kind::Let) << " " << node->name() << "["
+      << node->size() << "]";
+}
+
+void ASTPrinter::visitIndexNode(IndexExprAST* node) {
+  os_ << node->array() << "[";
+  visitNode(node->index());
+  os_ << "]";
 }
 
 std::string ASTPrinter::result() const {
@@ -4,22 +4,23 @@
 
 #include "ast.h"
 
-class ASTPrinter : public ASTNodeVisitor {
+class ASTPrinter : public ASTVisitor<ASTPrinter> {
  public:
   ASTPrinter();
 
-  void visitNode(ExprAST* node);
-
-  void visitLiteralNode(LiteralExprAST* node) override;
-  void visitVariableNode(VariableExprAST* node) override;
-  void visitPrefixNode(PrefixExprAST* node) override;
-  void visitBinaryNode(BinaryExprAST* node) override;
-  void visitBlockNode(BlockExprAST* node) override;
-  void visitCallNode(CallExprAST* node) override;
-  void visitPrototypeNode(PrototypeAST* node) override;
-  void visitFunctionNode(FunctionAST* node) override;
-  void visitLetNode(LetExprAST* node) override;
-  void visitIfNode(IfExprAST* node) override;
+  void visitLiteralNode(LiteralExprAST* node);
+  void visitVariableNode(VariableExprAST* node);
+  void visitPrefixNode(PrefixExprAST* node);
+  void visitBinaryNode(BinaryExprAST* node);
+  void visitBlockNode(BlockExprAST* node);
+  void visitCallNode(CallExprAST* node);
+  void visitPrototypeNode(PrototypeAST* node);
+  void visitFunctionNode(FunctionAST* node);
+  void visitLetNode(LetExprAST* node);
+  void visitIfNode(IfExprAST* node);
+  void visitLoopNode(LoopExprAST* node);
+  void visitArrayNode(ArrayExprAST* node);
+  void visitIndexNode(IndexExprAST* node);
 
   std::string result() const;
   void clear();
@@ -0,0 +1,198 @@
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "codegen.h"
+#include "corpus.h"
+#include "emitter.h"
+#include "parser.h"
+#include "tokenizer.h"
+#include "fmt.h"
+
+// cata_bench [-O0|-O1|-O2|-O3|-Os] [--functions=N] [--repeat=N] [--seed=N]
+//            [--threads=N] [--write=DIR] [corpus...]
+//
+// Generates each corpus (defs, nested, comments, shadowing; all of them by
+// default) and times the tokenizer, the parser and code generation on it,
+// keeping the best of --repeat runs. Parsing includes lexing into the
+// token buffer, split between N threads as cata --threads=N does, which
+// shows as stage parse/N; codegen declares every prototype and generates
+// every item into a fresh module, with the per-function passes of the -O
+// level, O0 (none) by default. The corpora are the same for the same
+// --functions and --seed, and --write saves them as DIR/<corpus>.cata to
+// feed to cata.
+//
+// Prints one line per corpus and stage, in columns that stay put:
+//   corpus stage bytes functions best_ms MB/s functions/s
+
+namespace {
+
+struct BenchOptions {
+  OptLevel opt_level{OptLevel::O0};
+  uint64_t functions{2000};
+  uint64_t repeat{5};
+  uint64_t seed{1};
+  uint64_t threads{1};
+  std::string write_dir{};
+  std::vector<CorpusKind> corpora{};
+};
+
+uint64_t parse_count(std::string_view value, std::string_view arg) {
+  uint64_t count = 0;
+  auto [end, ec] =
+      std::from_chars(value.data(), value.data() + value.size(), count);
+  if (ec != std::errc{} || end != value.data() + value.size())
+    error("%s takes a number", std::string{arg}.c_str());
+  return count;
+}
+
+BenchOptions parse_bench_options(int argc, char* argv[]) {
+  BenchOptions options;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg{argv[i]};
+    if (arg == "-O0") {
+      options.opt_level = OptLevel::O0;
+    } else if (arg == "-O1") {
+      options.opt_level = OptLevel::O1;
+    } else if (arg == "-O2" || arg == "-O") {
+      options.opt_level = OptLevel::O2;
+    } else if (arg == "-O3") {
+      options.opt_level = OptLevel::O3;
+    } else if (arg == "-Os") {
+      options.opt_level = OptLevel::Os;
+    } else if (arg.starts_with("--functions=")) {
+      options.functions = parse_count(arg.substr(12), "--functions");
+    } else if (arg.starts_with("--repeat=")) {
+      options.repeat = parse_count(arg.substr(9), "--repeat");
+      if (options.repeat == 0) error("--repeat must be at least 1");
+    } else if (arg.starts_with("--seed=")) {
+      options.seed = parse_count(arg.substr(7), "--seed");
+      if (options.seed > std::numeric_limits<uint32_t>::max())
+        error("--seed must fit in 32 bits");
+    } else if (arg.starts_with("--threads=")) {
+      options.threads = parse_count(arg.substr(10), "--threads");
+      if (options.threads == 0) error("--threads must be at least 1");
+    } else if (arg.starts_with("--write=")) {
+      options.write_dir = arg.substr(8);
+    } else if (std::optional<CorpusKind> kind = parse_corpus_kind(arg)) {
+      options.corpora.push_back(*kind);
+    } else {
+      error("unknown argument, %s", argv[i]);
+    }
+  }
+  if (options.corpora.empty())
+    options.corpora.assign(std::begin(corpus_kinds), std::end(corpus_kinds));
+  return options;
+}
+
+using Clock = std::chrono::steady_clock;
+
+double milliseconds(Clock::duration duration) {
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+// the best of repeat runs of run, which times its own part of the work, so
+// setup and teardown are left out
+template <typename Run>
+double best_of(uint64_t repeat, Run run) {
+  double best = std::numeric_limits<double>::infinity();
+  for (uint64_t i = 0; i < repeat; ++i) {
+    best = std::min(best, milliseconds(run()));
+  }
+  return best;
+}
+
+Clock::duration time_lexing(const std::string& source) {
+  SymbolTable symbols;
+  Tokenizer tokenizer{SourceBuffer::from_string(source), symbols};
+  auto start = Clock::now();
+  while (tokenizer.next_token().kind() != Token::Kind::Eof) {
+  }
+  return Clock::now() - start;
+}
+
+Clock::duration time_parsing(const std::string& source, size_t threads) {
+  ASTContext context;
+  SourceBuffer buffer = SourceBuffer::from_string(source);
+  auto start = Clock::now();
+  parse_file(std::move(buffer), context, threads);
+  return Clock::now() - start;
+}
+
+Clock::duration time_codegen(std::span<ExprAST* const> items,
+                             OptLevel opt_level, Emitter& emitter) {
+  Codegen codegen;
+  codegen.set_opt_level(opt_level, &emitter.target_machine());
+  auto start = Clock::now();
+  for (ExprAST* item : items) {
+    if (item->kind() == ExprKind::Function)
+      codegen.declare(static_cast<FunctionAST*>(item)->prototype());
+  }
+  for (ExprAST* item : items) {
+    codegen.visitNode(item);
+  }
+  return Clock::now() - start;
+}
+
+void print_row(const char* corpus, const char* stage, size_t bytes,
+               size_t functions, double best_ms) {
+  double seconds = best_ms / 1000;
+  std::printf("%-10s %-8s %10zu %9zu %10.3f %9.2f %11.0f\n", corpus, stage,
+              bytes, functions, best_ms, bytes / 1e6 / seconds,
+              functions / seconds);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  BenchOptions options = parse_bench_options(argc, argv);
+  std::string parse_stage = "parse";
+  if (options.threads != 1)
+    parse_stage += "/" + std::to_string(options.threads);
+  if (!options.write_dir.empty())
+    std::filesystem::create_directories(options.write_dir);
+  Emitter emitter{options.opt_level};
+  std::printf("%-10s %-8s %10s %9s %10s %9s %11s\n", "corpus", "stage",
+              "bytes", "functions", "best_ms", "MB/s", "functions/s");
+  for (CorpusKind kind : options.corpora) {
+    const char* name = corpus_name(kind);
+    std::string source = generate_corpus(kind, options.functions,
+                                         static_cast<uint32_t>(options.seed));
+    if (!options.write_dir.empty()) {
+      std::filesystem::path path = std::filesystem::path{options.write_dir} /
+                                   (std::string{name} + ".cata");
+      std::ofstream file{path, std::ios::binary};
+      file << source;
+      if (!file) error("could not write %s", path.c_str());
+    }
+    ASTContext context;
+    std::vector<ExprAST*> items =
+        Parser{SourceBuffer::from_string(source, name), context}.parse();
+    size_t functions =
+        std::count_if(items.begin(), items.end(), [](ExprAST* item) {
+          return item->kind() == ExprKind::Function;
+        });
+
+    print_row(name, "lex", source.size(), functions,
+              best_of(options.repeat, [&] { return time_lexing(source); }));
+    print_row(name, parse_stage.c_str(), source.size(), functions,
+              best_of(options.repeat, [&] {
+                return time_parsing(source, options.threads);
+              }));
+    print_row(name, "codegen", source.size(), functions,
+              best_of(options.repeat, [&] {
+                return time_codegen(items, options.opt_level, emitter);
+              }));
+    std::fflush(stdout);
+  }
+  return 0;
+}
@@ -0,0 +1,281 @@
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <vector>
+
+#include "corpus.h"
+
+namespace {
+
+// shifts are kept apart, their right operand is a small literal so that
+// none overflows
+const char* const binary_operators[] = {"+",  "-",  "*",  "&", "|",
+                                        "^",  "<",  "<=", ">", ">=",
+                                        "==", "!=", "&&", "||"};
+const char* const shift_operators[] = {"<<", ">>"};
+const char* const prefix_operators[] = {"-", "~", "!"};
+
+const char* const words[] = {
+    "the",      "value",   "of",      "each",     "call",    "is",
+    "folded",   "into",    "a",       "constant", "when",    "its",
+    "operands", "are",     "known",   "at",       "compile", "time",
+    "so",       "nothing", "remains", "for",      "runtime", "but",
+    "loads",    "and",     "stores",  "through",  "arrays",  "declared",
+    "before",   "use",     "in",      "order",    "which",   "keeps"};
+
+class Generator {
+ public:
+  explicit Generator(uint32_t seed) : random_{seed} {}
+
+  std::string generate(CorpusKind kind, size_t functions) {
+    out_ += "extern input();\nextern print(a);\n";
+    for (size_t i = 0; i < functions; ++i) {
+      out_ += '\n';
+      switch (kind) {
+        case CorpusKind::Defs:
+          definition(i);
+          break;
+        case CorpusKind::Nested:
+          nested(i);
+          break;
+        case CorpusKind::Comments:
+          commented(i);
+          break;
+        case CorpusKind::Shadowing:
+          shadowing(i);
+          break;
+      }
+    }
+    main_function();
+    return std::move(out_);
+  }
+
+ private:
+  // the engine is specified to the bit, the standard distributions are not
+  std::mt19937 random_;
+  std::string out_;
+  // of every function generated so far
+  std::vector<size_t> arities_;
+
+  uint32_t pick(uint32_t n) { return random_() % n; }
+
+  void indent(int level) { out_.append(4 * level, ' '); }
+
+  void prototype(size_t index, size_t arity) {
+    arities_.push_back(arity);
+    out_ += "def f" + std::to_string(index) + "(";
+    for (size_t i = 0; i < arity; ++i) {
+      if (i) out_ += ", ";
+      out_ += "p" + std::to_string(i);
+    }
+    out_ += ") {\n";
+  }
+
+  void operand(size_t arity) {
+    if (pick(3) == 0)
+      out_ += std::to_string(pick(100));
+    else
+      out_ += "p" + std::to_string(pick(arity));
+  }
+
+  // depth binary operators, nested to the left or right at random
+  void expression(size_t arity, int depth) {
+    if (depth == 0) {
+      operand(arity);
+      return;
+    }
+    if (pick(8) == 0) out_ += prefix_operators[pick(3)];
+    out_ += '(';
+    if (pick(5) == 0) {
+      expression(arity, depth - 1);
+      out_ += std::string{" "} + shift_operators[pick(2)] + " ";
+      out_ += std::to_string(1 + pick(7));
+    } else if (pick(2) == 0) {
+      expression(arity, depth - 1);
+      out_ += std::string{" "} + binary_operators[pick(14)] + " ";
+      operand(arity);
+    } else {
+      operand(arity);
+      out_ += std::string{" "} + binary_operators[pick(14)] + " ";
+      expression(arity, depth - 1);
+    }
+    out_ += ')';
+  }
+
+  // a call to an earlier function, or an expression in the first one
+  void call(size_t index, size_t arity) {
+    if (index == 0) {
+      expression(arity, 1);
+      return;
+    }
+    size_t callee = index - 1 - pick(std::min<size_t>(index, 16));
+    out_ += "f" + std::to_string(callee) + "(";
+    for (size_t i = 0; i < arities_[callee]; ++i) {
+      if (i) out_ += ", ";
+      expression(arity, pick(2));
+    }
+    out_ += ')';
+  }
+
+  void comment_line(int level) {
+    indent(level);
+    out_ += "//";
+    for (uint32_t i = 0, n = 4 + pick(9); i < n; ++i) {
+      out_ += ' ';
+      out_ += words[pick(std::size(words))];
+    }
+    out_ += '\n';
+  }
+
+  // a few statements over v, with a branch, a loop and calls
+  void body(size_t index, size_t arity, bool comments) {
+    if (comments) comment_line(1);
+    indent(1);
+    out_ += "let v = ";
+    expression(arity, 2);
+    out_ += ";\n";
+    for (uint32_t i = 0, n = 1 + pick(4); i < n; ++i) {
+      if (comments) comment_line(1);
+      switch (pick(3)) {
+        case 0:
+          indent(1);
+          out_ += "v = v + ";
+          call(index, arity);
+          out_ += ";\n";
+          break;
+        case 1:
+          indent(1);
+          out_ += "if (v > " + std::to_string(pick(100)) + ") {\n";
+          indent(2);
+          out_ += "v = v - p0;\n";
+          indent(1);
+          out_ += "} else {\n";
+          indent(2);
+          out_ += "v = ";
+          call(index, arity);
+          out_ += ";\n";
+          indent(1);
+          out_ += "}\n";
+          break;
+        case 2:
+          indent(1);
+          out_ += "for (let k = 0; k < " + std::to_string(2 + pick(6)) +
+                  "; k = k + 1) {\n";
+          indent(2);
+          out_ += "v = v * 3 + k;\n";
+          indent(1);
+          out_ += "}\n";
+          break;
+      }
+    }
+    indent(1);
+    out_ += "v;\n";
+  }
+
+  void definition(size_t index) {
+    size_t arity = 1 + pick(3);
+    prototype(index, arity);
+    body(index, arity, false);
+    out_ += "}\n";
+  }
+
+  void nested(size_t index) {
+    size_t arity = 1 + pick(4);
+    prototype(index, arity);
+    indent(1);
+    out_ += "let v = ";
+    expression(arity, 16 + pick(48));
+    out_ += ";\n";
+    indent(1);
+    out_ += "v + ";
+    expression(arity, 16 + pick(48));
+    out_ += ";\n}\n";
+  }
+
+  void commented(size_t index) {
+    out_ += "/*\n";
+    for (uint32_t i = 0, n = 8 + pick(32); i < n; ++i) {
+      out_ += " *";
+      for (uint32_t j = 0, m = 6 + pick(7); j < m; ++j) {
+        out_ += ' ';
+        out_ += words[pick(std::size(words))];
+      }
+      out_ += '\n';
+    }
+    out_ += " */\n";
+    size_t arity = 1 + pick(3);
+    prototype(index, arity);
+    body(index, arity, true);
+    out_ += "}\n";
+  }
+
+  // each block shadows x and y again, from the outer bindings
+  void shadowing_block(int level, int depth) {
+    for (uint32_t i = 0, n = 2 + pick(3); i < n; ++i) {
+      indent(level);
+      out_ += pick(2) ? "let x = x " : "let y = x ";
+      out_ += binary_operators[pick(3)];
+      out_ += " " + std::to_string(1 + pick(9)) + ";\n";
+      indent(level);
+      out_ += "let x = y + x;\n";
+    }
+    if (level == depth) return;
+    indent(level);
+    out_ += "if (x > " + std::to_string(pick(100)) + ") {\n";
+    indent(level + 1);
+    out_ += "let y = x;\n";
+    shadowing_block(level + 1, depth);
+    indent(level + 1);
+    out_ += "y = x;\n";
+    indent(level);
+    out_ += "}\n";
+  }
+
+  void shadowing(size_t index) {
+    prototype(index, 1);
+    out_ += "    let x = p0;\n    let y = 0;\n";
+    shadowing_block(1, 3 + pick(6));
+    out_ += "    x + y;\n}\n";
+  }
+
+  void main_function() {
+    out_ += "\ndef main() {\n    let n = input();\n";
+    if (!arities_.empty()) {
+      out_ += "    print(f" + std::to_string(arities_.size() - 1) + "(";
+      for (size_t i = 0; i < arities_.back(); ++i) {
+        if (i) out_ += ", ";
+        out_ += "n";
+      }
+      out_ += "));\n";
+    }
+    out_ += "}\n";
+  }
+};
+
+}  // namespace
+
+const char* corpus_name(CorpusKind kind) {
+  switch (kind) {
+    case CorpusKind::Defs:
+      return "defs";
+    case CorpusKind::Nested:
+      return "nested";
+    case CorpusKind::Comments:
+      return "comments";
+    case CorpusKind::Shadowing:
+      return "shadowing";
+  }
+  return "?";
+}
+
+std::optional<CorpusKind> parse_corpus_kind(std::string_view name) {
+  for (CorpusKind kind : corpus_kinds) {
+    if (name == corpus_name(kind)) return kind;
+  }
+  return std::nullopt;
+}
+
+std::string generate_corpus(CorpusKind kind, size_t functions,
+                            uint32_t seed) {
+  return Generator{seed}.generate(kind, functions);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+// Synthetic programs for cata_bench, each stressing one part of the front
+// end:
+//  defs       many small definitions calling each other
+//  nested     deep expression nests
+//  comments   long comment blocks around short definitions
+//  shadowing  let bindings shadowed over and over in nested blocks
+enum class CorpusKind { Defs, Nested, Comments, Shadowing };
+
+constexpr CorpusKind corpus_kinds[] = {CorpusKind::Defs, CorpusKind::Nested,
+                                       CorpusKind::Comments,
+                                       CorpusKind::Shadowing};
+
+const char* corpus_name(CorpusKind kind);
+std::optional<CorpusKind> parse_corpus_kind(std::string_view name);
+
+// a program of kind with functions definitions besides main, which reads
+// an input and prints the last one's result; the same arguments give the
+// same program, byte for byte, on every platform
+std::string generate_corpus(CorpusKind kind, size_t functions,
+                            uint32_t seed);
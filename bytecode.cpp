@@ -0,0 +1,522 @@
+#include <algorithm>
+#include <iterator>
+#include <limits>
+
+#include "bytecode.h"
+#include "fmt.h"
+#include "runtime.h"
+
+static bool is_comparison(Token::Kind op) {
+  switch (op) {
+    case Token::Kind::Eq:
+    case Token::Kind::Ne:
+    case Token::Kind::Lt:
+    case Token::Kind::Le:
+    case Token::Kind::Gt:
+    case Token::Kind::Ge:
+      return true;
+    default:
+      return false;
+  }
+}
+
+static Opcode binary_opcode(Token::Kind op) {
+  switch (op) {
+    case Token::Kind::Plus:
+      return Opcode::Add;
+    case Token::Kind::Minus:
+      return Opcode::Sub;
+    case Token::Kind::Star:
+      return Opcode::Mul;
+    case Token::Kind::Slash:
+      return Opcode::Div;
+    case Token::Kind::Remainder:
+      return Opcode::Rem;
+    case Token::Kind::Ampersand:
+      return Opcode::And;
+    case Token::Kind::Pipe:
+      return Opcode::Or;
+    case Token::Kind::Caret:
+      return Opcode::Xor;
+    case Token::Kind::LeftShift:
+      return Opcode::Shl;
+    case Token::Kind::RightShift:
+      return Opcode::Shr;
+    case Token::Kind::Eq:
+      return Opcode::Eq;
+    case Token::Kind::Ne:
+      return Opcode::Ne;
+    case Token::Kind::Lt:
+      return Opcode::Lt;
+    case Token::Kind::Le:
+      return Opcode::Le;
+    case Token::Kind::Gt:
+      return Opcode::Gt;
+    case Token::Kind::Ge:
+      return Opcode::Ge;
+    default:
+      error("invalid binary operator, %s", Token(op).as_string().c_str());
+  }
+}
+
+// the JumpUnless forms are laid out in comparison order, register operands
+// first, then immediates
+static Opcode branch_opcode(Token::Kind op, bool immediate) {
+  int offset = static_cast<int>(binary_opcode(op)) -
+               static_cast<int>(Opcode::Eq);
+  Opcode first = immediate ? Opcode::JumpUnlessEqImm : Opcode::JumpUnlessEq;
+  return static_cast<Opcode>(static_cast<int>(first) + offset);
+}
+
+// `x + 1`, `x - 1`: the constant as an AddImm operand, if it fits in bits
+static bool add_immediate(ExprAST* node, int64_t limit, ExprAST*& operand,
+                          int32_t& value) {
+  if (node->kind() != ExprKind::Binary) return false;
+  auto binary = static_cast<BinaryExprAST*>(node);
+  if (binary->op() != Token::Kind::Plus && binary->op() != Token::Kind::Minus)
+    return false;
+  if (binary->rhs()->kind() != ExprKind::Literal) return false;
+  int64_t constant = static_cast<LiteralExprAST*>(binary->rhs())->value();
+  if (binary->op() == Token::Kind::Minus) constant = -constant;
+  if (constant < -limit - 1 || constant > limit) return false;
+  operand = binary->lhs();
+  value = static_cast<int32_t>(constant);
+  return true;
+}
+
+BytecodeProgram BytecodeCompiler::compile(std::span<ExprAST* const> items) {
+  program_ = {};
+  std::vector<FunctionAST*> definitions;
+  for (ExprAST* item : items) {
+    FunctionAST* definition = nullptr;
+    PrototypeAST* prototype;
+    if (item->kind() == ExprKind::Function) {
+      definition = static_cast<FunctionAST*>(item);
+      prototype = definition->prototype();
+    } else if (item->kind() == ExprKind::Array) {
+      error("array %s needs compiled code, run with --engine=jit",
+            static_cast<ArrayExprAST*>(item)->name().str().c_str());
+    } else {
+      prototype = static_cast<PrototypeAST*>(item);
+    }
+    auto [it, inserted] = program_.function_indices.try_emplace(
+        prototype->name(), program_.functions.size());
+    if (inserted) {
+      program_.functions.push_back(
+          {prototype->name(),
+           static_cast<uint16_t>(prototype->args().size()), 0, 0});
+      definitions.push_back(nullptr);
+    }
+    BytecodeFunction& function = program_.functions[it->second];
+    if (function.arg_count != prototype->args().size())
+      error("function %s expects %u arguments, but got %lu",
+            prototype->name().str().c_str(), function.arg_count,
+            prototype->args().size());
+    if (definition) {
+      if (definitions[it->second])
+        error("redefinition of function, %s",
+              prototype->name().str().c_str());
+      definitions[it->second] = definition;
+    }
+  }
+  // externs the runtime defines are called directly
+  runtime_indices_.assign(definitions.size(), -1);
+  for (size_t i = 0; i < definitions.size(); ++i) {
+    if (definitions[i]) continue;
+    for (size_t j = 0; j < std::size(runtime_functions); ++j) {
+      if (program_.functions[i].name.str() == runtime_functions[j].name)
+        runtime_indices_[i] = static_cast<int32_t>(j);
+    }
+  }
+  for (size_t i = 0; i < definitions.size(); ++i) {
+    BytecodeFunction& function = program_.functions[i];
+    function.entry = program_.code.size();
+    if (definitions[i]) {
+      visitNode(definitions[i]);
+      function.frame_size = frame_size_;
+    } else {
+      // reported when called, like the interpreter does
+      emit({Opcode::Undefined, 0, 0, 0, static_cast<int32_t>(i)});
+      function.frame_size = function.arg_count;
+    }
+  }
+  return std::move(program_);
+}
+
+uint16_t BytecodeCompiler::visitLiteralNode(LiteralExprAST* node) {
+  uint16_t result = allocate_register();
+  emit({Opcode::LoadConst, result, 0, 0, node->value()});
+  return result;
+}
+
+uint16_t BytecodeCompiler::visitVariableNode(VariableExprAST* node) {
+  return get_variable(node->name());
+}
+
+uint16_t BytecodeCompiler::visitPrefixNode(PrefixExprAST* node) {
+  if (node->op() == Token::Kind::Plus) return visitNode(node->operand());
+  Opcode op;
+  switch (node->op()) {
+    case Token::Kind::Not:
+      op = Opcode::Not;
+      break;
+    case Token::Kind::Minus:
+      op = Opcode::Neg;
+      break;
+    case Token::Kind::Tilde:
+      op = Opcode::BitNot;
+      break;
+    default:
+      error("invalid prefix operator, %s",
+            Token(node->op()).as_string().c_str());
+  }
+  uint16_t base = next_register_;
+  uint16_t operand = visitNode(node->operand());
+  next_register_ = base;
+  uint16_t result = allocate_register();
+  emit({op, result, operand});
+  return result;
+}
+
+uint16_t BytecodeCompiler::visitBinaryNode(BinaryExprAST* node) {
+  if (node->op() == Token::Kind::Equals) {
+    if (node->lhs()->kind() == ExprKind::Index) return visitNode(node->lhs());
+    if (node->lhs()->kind() != ExprKind::Variable)
+      error("left hand side of assignment must be a variable");
+    uint16_t variable =
+        get_variable(static_cast<VariableExprAST*>(node->lhs())->name());
+    uint16_t value = visitNode(node->rhs());
+    if (value != variable) emit({Opcode::Move, variable, value});
+    return variable;
+  }
+  if (node->op() == Token::Kind::And || node->op() == Token::Kind::Or) {
+    uint16_t result = allocate_register();
+    std::vector<size_t> to_false;
+    emit_branch_unless(node, to_false);
+    emit({Opcode::LoadConst, result, 0, 0, 1});
+    size_t to_end = emit({Opcode::Jump});
+    for (size_t jump : to_false) patch_jump(jump);
+    emit({Opcode::LoadConst, result, 0, 0, 0});
+    patch_jump(to_end);
+    next_register_ = result + 1;
+    return result;
+  }
+  // temporaries of the operands are dead once the result is computed
+  uint16_t base = next_register_;
+  ExprAST* operand;
+  int32_t constant;
+  if (add_immediate(node, std::numeric_limits<int32_t>::max(), operand,
+                    constant)) {
+    uint16_t lhs = visitNode(operand);
+    next_register_ = base;
+    uint16_t result = allocate_register();
+    emit({Opcode::AddImm, result, lhs, 0, constant});
+    return result;
+  }
+  if (node->op() == Token::Kind::Tilde) {
+    visitNode(node->lhs());
+    uint16_t rhs = visitNode(node->rhs());
+    next_register_ = base;
+    uint16_t result = allocate_register();
+    emit({Opcode::BitNot, result, rhs});
+    return result;
+  }
+  uint16_t lhs = visitNode(node->lhs());
+  if (lhs < variables_top_ && assigning_.contains(node->rhs())) {
+    uint16_t copy = allocate_register();
+    emit({Opcode::Move, copy, lhs});
+    lhs = copy;
+  }
+  uint16_t rhs = visitNode(node->rhs());
+  next_register_ = base;
+  uint16_t result = allocate_register();
+  emit({binary_opcode(node->op()), result, lhs, rhs});
+  return result;
+}
+
+uint16_t BytecodeCompiler::visitBlockNode(BlockExprAST* node) {
+  if (node->exprs().empty()) error("empty block has no value");
+  uint16_t base = next_register_;
+  uint16_t result = 0;
+  for (ExprAST* expr : node->exprs()) {
+    // statement temporaries are dead, variables it declared are not
+    next_register_ = std::max(base, variables_top_);
+    result = visitNode(expr);
+  }
+  return result;
+}
+
+uint16_t BytecodeCompiler::visitCallNode(CallExprAST* node) {
+  auto it = program_.function_indices.find(node->callee());
+  if (it == program_.function_indices.end())
+    error("called undefined function, %s", node->callee().str().c_str());
+  const BytecodeFunction& callee = program_.functions[it->second];
+  auto args = node->args();
+  if (callee.arg_count != args.size())
+    error("function %s expects %u arguments, but got %lu",
+          node->callee().str().c_str(), callee.arg_count, args.size());
+  int32_t runtime = runtime_indices_[it->second];
+  // arguments go to consecutive registers, where the callee's frame starts
+  uint16_t window = next_register_;
+  ExprAST* operand;
+  int32_t constant;
+  if (runtime < 0 && args.size() == 1 &&
+      add_immediate(args[0], std::numeric_limits<int16_t>::max(), operand,
+                    constant)) {
+    allocate_register();
+    uint16_t value = visitNode(operand);
+    emit({Opcode::CallAddImm, window, value,
+          static_cast<uint16_t>(static_cast<int16_t>(constant)),
+          static_cast<int32_t>(it->second)});
+    next_register_ = window + 1;
+    return window;
+  }
+  for (size_t i = 0; i < args.size(); ++i) {
+    next_register_ = window + i;
+    uint16_t value = visitNode(args[i]);
+    if (value != window + i) {
+      next_register_ = window + i;
+      emit({Opcode::Move, allocate_register(), value});
+    }
+    next_register_ = window + i + 1;
+  }
+  next_register_ = window;
+  for (size_t i = 0; i < std::max<size_t>(args.size(), 1); ++i) {
+    allocate_register();
+  }
+  if (runtime >= 0) {
+    emit({Opcode::CallRuntime, window, static_cast<uint16_t>(args.size()), 0,
+          runtime});
+  } else {
+    emit({Opcode::Call, window, 0, 0, static_cast<int32_t>(it->second)});
+  }
+  next_register_ = window + 1;
+  return window;
+}
+
+uint16_t BytecodeCompiler::visitPrototypeNode(PrototypeAST* node) {
+  error("unexpected prototype, %s", node->name().str().c_str());
+}
+
+uint16_t BytecodeCompiler::visitFunctionNode(FunctionAST* node) {
+  variables_.clear();
+  assigning_.clear();
+  auto args = node->prototype()->args();
+  for (size_t i = 0; i < args.size(); ++i) {
+    variables_.emplace_back(args[i], static_cast<uint16_t>(i));
+  }
+  variables_top_ = next_register_ = frame_size_ = args.size();
+  mark_assigning(node->body());
+  uint16_t result = visitNode(node->body());
+  emit({Opcode::Ret, 0, result});
+  return result;
+}
+
+uint16_t BytecodeCompiler::visitLetNode(LetExprAST* node) {
+  uint16_t base = next_register_;
+  uint16_t value = visitNode(node->expr());
+  uint16_t variable = value;
+  if (value != base) {
+    next_register_ = base;
+    variable = allocate_register();
+    emit({Opcode::Move, variable, value});
+  }
+  variables_.emplace_back(node->name(), variable);
+  variables_top_ = next_register_ = variable + 1;
+  return variable;
+}
+
+uint16_t BytecodeCompiler::visitIfNode(IfExprAST* node) {
+  uint16_t result = allocate_register();
+  std::vector<size_t> to_else;
+  emit_branch_unless(node->condition(), to_else);
+  // each branch is a scope, its lets end with it
+  size_t scope = variables_.size();
+  uint16_t scope_top = variables_top_;
+  auto branch = [&](ExprAST* expr) {
+    next_register_ = result + 1;
+    uint16_t value = visitNode(expr);
+    if (value != result) emit({Opcode::Move, result, value});
+    variables_.resize(scope);
+    variables_top_ = scope_top;
+  };
+  branch(node->then_expr());
+  size_t to_end = emit({Opcode::Jump});
+  for (size_t jump : to_else) patch_jump(jump);
+  if (node->else_expr()) {
+    branch(node->else_expr());
+  } else {
+    emit({Opcode::LoadConst, result, 0, 0, 0});
+  }
+  patch_jump(to_end);
+  next_register_ = result + 1;
+  return result;
+}
+
+uint16_t BytecodeCompiler::visitLoopNode(LoopExprAST* node) {
+  // the loop is a scope for its init, the body one for each iteration
+  size_t scope = variables_.size();
+  uint16_t scope_top = variables_top_;
+  uint16_t base = next_register_;
+  auto statement = [&](ExprAST* expr) {
+    next_register_ = std::max(base, variables_top_);
+    visitNode(expr);
+  };
+  if (node->init()) statement(node->init());
+  size_t body_scope = variables_.size();
+  uint16_t body_top = variables_top_;
+  size_t head = program_.code.size();
+  next_register_ = std::max(base, variables_top_);
+  std::vector<size_t> to_end;
+  if (node->condition()) emit_branch_unless(node->condition(), to_end);
+  if (!is_empty_block(node->body())) statement(node->body());
+  variables_.resize(body_scope);
+  variables_top_ = body_top;
+  if (node->step()) statement(node->step());
+  emit({Opcode::Jump, 0, 0, 0, static_cast<int32_t>(head)});
+  for (size_t jump : to_end) patch_jump(jump);
+  variables_.resize(scope);
+  variables_top_ = scope_top;
+  next_register_ = base;
+  uint16_t result = allocate_register();
+  emit({Opcode::LoadConst, result, 0, 0, 0});
+  return result;
+}
+
+uint16_t BytecodeCompiler::visitArrayNode(ArrayExprAST* node) {
+  error("array %s needs compiled code, run with --engine=jit",
+        node->name().str().c_str());
+}
+
+uint16_t BytecodeCompiler::visitIndexNode(IndexExprAST* node) {
+  error("array %s needs compiled code, run with --engine=jit",
+        node->array().str().c_str());
+}
+
+uint16_t BytecodeCompiler::allocate_register() {
+  if (next_register_ == std::numeric_limits<uint16_t>::max())
+    error("function needs more than %u registers", next_register_);
+  frame_size_ = std::max<uint16_t>(frame_size_, next_register_ + 1);
+  return next_register_++;
+}
+
+uint16_t BytecodeCompiler::get_variable(Symbol name) {
+  for (auto it = variables_.rbegin(); it != variables_.rend(); ++it) {
+    if (it->first == name) return it->second;
+  }
+  error("use of undeclared variable, %s", name.str().c_str());
+}
+
+size_t BytecodeCompiler::emit(BytecodeInstruction instruction) {
+  program_.code.push_back(instruction);
+  return program_.code.size() - 1;
+}
+
+void BytecodeCompiler::patch_jump(size_t index) {
+  program_.code[index].imm = program_.code.size();
+}
+
+void BytecodeCompiler::emit_branch_unless(ExprAST* cond,
+                                          std::vector<size_t>& to_false) {
+  uint16_t base = next_register_;
+  size_t jump;
+  auto binary = static_cast<BinaryExprAST*>(cond);
+  if (cond->kind() == ExprKind::Binary && binary->op() == Token::Kind::And) {
+    emit_branch_unless(binary->lhs(), to_false);
+    return emit_branch_unless(binary->rhs(), to_false);
+  }
+  if (cond->kind() == ExprKind::Binary && binary->op() == Token::Kind::Or) {
+    // a true lhs jumps over the rhs test, to where the condition holds
+    std::vector<size_t> to_rhs;
+    emit_branch_unless(binary->lhs(), to_rhs);
+    size_t to_true = emit({Opcode::Jump});
+    for (size_t jump : to_rhs) patch_jump(jump);
+    emit_branch_unless(binary->rhs(), to_false);
+    return patch_jump(to_true);
+  }
+  if (cond->kind() == ExprKind::Binary && is_comparison(binary->op())) {
+    uint16_t lhs = visitNode(binary->lhs());
+    // literals that fit in 16 bits are compared against an immediate
+    bool immediate = false;
+    int32_t constant = 0;
+    if (binary->rhs()->kind() == ExprKind::Literal) {
+      constant = static_cast<LiteralExprAST*>(binary->rhs())->value();
+      immediate = constant == static_cast<int16_t>(constant);
+    }
+    if (immediate) {
+      jump = emit({branch_opcode(binary->op(), true), 0, lhs,
+                   static_cast<uint16_t>(static_cast<int16_t>(constant))});
+    } else {
+      if (lhs < variables_top_ && assigning_.contains(binary->rhs())) {
+        uint16_t copy = allocate_register();
+        emit({Opcode::Move, copy, lhs});
+        lhs = copy;
+      }
+      uint16_t rhs = visitNode(binary->rhs());
+      jump = emit({branch_opcode(binary->op(), false), 0, lhs, rhs});
+    }
+  } else {
+    jump = emit({Opcode::JumpIfZero, 0, visitNode(cond)});
+  }
+  next_register_ = base;
+  to_false.push_back(jump);
+}
+
+bool BytecodeCompiler::mark_assigning(ExprAST* node) {
+  if (!node) return false;
+  bool assigns = false;
+  switch (node->kind()) {
+    case ExprKind::Literal:
+    case ExprKind::Variable:
+    case ExprKind::Prototype:
+      return false;
+    case ExprKind::Prefix:
+      assigns = mark_assigning(static_cast<PrefixExprAST*>(node)->operand());
+      break;
+    case ExprKind::Binary: {
+      auto binary = static_cast<BinaryExprAST*>(node);
+      assigns = binary->op() == Token::Kind::Equals;
+      assigns |= mark_assigning(binary->lhs());
+      assigns |= mark_assigning(binary->rhs());
+      break;
+    }
+    case ExprKind::Block:
+      for (ExprAST* expr : static_cast<BlockExprAST*>(node)->exprs()) {
+        assigns |= mark_assigning(expr);
+      }
+      break;
+    case ExprKind::Call:
+      for (ExprAST* arg : static_cast<CallExprAST*>(node)->args()) {
+        assigns |= mark_assigning(arg);
+      }
+      break;
+    case ExprKind::Function:
+      assigns = mark_assigning(static_cast<FunctionAST*>(node)->body());
+      break;
+    case ExprKind::Let:
+      assigns = mark_assigning(static_cast<LetExprAST*>(node)->expr());
+      break;
+    case ExprKind::If: {
+      auto if_expr = static_cast<IfExprAST*>(node);
+      assigns = mark_assigning(if_expr->condition());
+      assigns |= mark_assigning(if_expr->then_expr());
+      assigns |= mark_assigning(if_expr->else_expr());
+      break;
+    }
+    case ExprKind::Loop: {
+      auto loop = static_cast<LoopExprAST*>(node);
+      assigns = mark_assigning(loop->init());
+      assigns |= mark_assigning(loop->condition());
+      assigns |= mark_assigning(loop->step());
+      assigns |= mark_assigning(loop->body());
+      break;
+    }
+    case ExprKind::Array:
+      return false;
+    case ExprKind::Index:
+      assigns = mark_assigning(static_cast<IndexExprAST*>(node)->index());
+      break;
+  }
+  if (assigns) assigning_.insert(node);
+  return assigns;
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "ast.h"
+
+// Register bytecode. a is the destination register, b and c are operands,
+// imm holds constants, jump targets and function indices. The Jump*Unless*
+// and CallAddImm forms are superinstructions for `if (x < y)` style
+// conditions and `f(n - 1)` style calls.
+#define CATA_OPCODES(X) \
+  X(LoadConst)          \
+  X(Move)               \
+  X(Add)                \
+  X(AddImm)             \
+  X(Sub)                \
+  X(Mul)                \
+  X(Div)                \
+  X(Rem)                \
+  X(And)                \
+  X(Or)                 \
+  X(Xor)                \
+  X(Shl)                \
+  X(Shr)                \
+  X(Eq)                 \
+  X(Ne)                 \
+  X(Lt)                 \
+  X(Le)                 \
+  X(Gt)                 \
+  X(Ge)                 \
+  X(Not)                \
+  X(Neg)                \
+  X(BitNot)             \
+  X(Jump)               \
+  X(JumpIfZero)         \
+  X(JumpUnlessEq)       \
+  X(JumpUnlessNe)       \
+  X(JumpUnlessLt)       \
+  X(JumpUnlessLe)       \
+  X(JumpUnlessGt)       \
+  X(JumpUnlessGe)       \
+  X(JumpUnlessEqImm)    \
+  X(JumpUnlessNeImm)    \
+  X(JumpUnlessLtImm)    \
+  X(JumpUnlessLeImm)    \
+  X(JumpUnlessGtImm)    \
+  X(JumpUnlessGeImm)    \
+  X(Call)               \
+  X(CallAddImm)         \
+  X(CallRuntime)        \
+  X(Undefined)          \
+  X(Ret)
+
+enum class Opcode : uint8_t {
+#define CATA_OPCODE_ENUM(name) name,
+  CATA_OPCODES(CATA_OPCODE_ENUM)
+#undef CATA_OPCODE_ENUM
+};
+
+struct BytecodeInstruction {
+  Opcode op;
+  uint16_t a = 0;
+  uint16_t b = 0;
+  uint16_t c = 0;
+  int32_t imm = 0;
+};
+
+struct BytecodeFunction {
+  Symbol name;
+  uint16_t arg_count;
+  // registers a call needs, arguments first
+  uint16_t frame_size;
+  // index of the first instruction in BytecodeProgram::code
+  uint32_t entry;
+};
+
+// Every function of a program in one code array. Calls name functions by
+// index, runtime calls index runtime_functions.
+struct BytecodeProgram {
+  std::vector<BytecodeInstruction> code;
+  std::vector<BytecodeFunction> functions;
+  std::unordered_map<Symbol, uint32_t> function_indices;
+};
+
+// Compiles parsed items to bytecode, resolving variables to registers and
+// callees to indices.
+class BytecodeCompiler : ASTVisitor<BytecodeCompiler, uint16_t> {
+ public:
+  BytecodeProgram compile(std::span<ExprAST* const> items);
+
+ private:
+  friend class ASTVisitor;
+
+  BytecodeProgram program_;
+  // index into runtime_functions of each function, or -1
+  std::vector<int32_t> runtime_indices_;
+  // register of the innermost binding of each variable, like codegen
+  std::vector<std::pair<Symbol, uint16_t>> variables_;
+  // registers below this hold variables, temporaries go above
+  uint16_t variables_top_ = 0;
+  uint16_t next_register_ = 0;
+  uint16_t frame_size_ = 0;
+  // right hand sides that assign, whose left operand must be read first
+  std::unordered_set<ExprAST*> assigning_;
+
+  uint16_t visitLiteralNode(LiteralExprAST* node);
+  uint16_t visitVariableNode(VariableExprAST* node);
+  uint16_t visitPrefixNode(PrefixExprAST* node);
+  uint16_t visitBinaryNode(BinaryExprAST* node);
+  uint16_t visitBlockNode(BlockExprAST* node);
+  uint16_t visitCallNode(CallExprAST* node);
+  uint16_t visitPrototypeNode(PrototypeAST* node);
+  uint16_t visitFunctionNode(FunctionAST* node);
+  uint16_t visitLetNode(LetExprAST* node);
+  uint16_t visitIfNode(IfExprAST* node);
+  uint16_t visitLoopNode(LoopExprAST* node);
+  uint16_t visitArrayNode(ArrayExprAST* node);
+  uint16_t visitIndexNode(IndexExprAST* node);
+
+  uint16_t allocate_register();
+  uint16_t get_variable(Symbol name);
+  size_t emit(BytecodeInstruction instruction);
+  // points the jump at index to the next instruction
+  void patch_jump(size_t index);
+  // branches over the code that follows when cond is false, adding the
+  // jumps to patch to to_false; && and || short-circuit
+  void emit_branch_unless(ExprAST* cond, std::vector<size_t>& to_false);
+  bool mark_assigning(ExprAST* node);
+};
@@ -0,0 +1,182 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <unordered_map>
+
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Process.h>
+#include <llvm/Support/SHA256.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "analysis.h"
+#include "astprinter.h"
+#include "cache.h"
+#include "timereport.h"
+
+namespace {
+
+const char* opt_level_name(OptLevel level) {
+  switch (level) {
+    case OptLevel::O0:
+      return "O0";
+    case OptLevel::O1:
+      return "O1";
+    case OptLevel::O2:
+      return "O2";
+    case OptLevel::O3:
+      return "O3";
+    case OptLevel::Os:
+      return "Os";
+  }
+  return "?";
+}
+
+// the cata binary, by path, size and modification time
+std::string compiler_identity() {
+  std::string path = sys::fs::getMainExecutable(
+      nullptr, reinterpret_cast<void*>(&compiler_identity));
+  sys::fs::file_status status;
+  if (sys::fs::status(path, status)) return path;
+  return path + " " + std::to_string(status.getSize()) + " " +
+         std::to_string(sys::toTimeT(status.getLastModificationTime()));
+}
+
+}  // namespace
+
+CompileCache::CompileCache(std::string directory, const Options& options,
+                           TargetMachine& target_machine)
+    : directory_{std::move(directory)} {
+  configuration_ = compiler_identity() + "\nLLVM " LLVM_VERSION_STRING "\n" +
+                   target_machine.getTargetTriple().str() + " " +
+                   target_machine.getTargetCPU().str() + " " +
+                   target_machine.getTargetFeatureString().str() + "\n" +
+                   opt_level_name(options.opt_level) + " emit " +
+                   std::to_string(static_cast<int>(options.emit)) +
+                   " steps " + std::to_string(options.const_eval_steps) +
+                   (options.auto_memo ? " auto-memo" : "") + "\n";
+}
+
+std::string CompileCache::output_key(std::string_view source) const {
+  return hash("output", source) + ".out";
+}
+
+std::string CompileCache::object_key(std::string_view source) const {
+  return hash("object", source) + ".o";
+}
+
+std::vector<std::string> CompileCache::function_keys(
+    std::span<ExprAST* const> items) const {
+  // a call compiles against the callee's prototype alone, the first one
+  // declared, as in codegen
+  std::unordered_map<Symbol, PrototypeAST*> prototypes;
+  for (ExprAST* item : items) {
+    if (item->kind() == ExprKind::Function) {
+      PrototypeAST* prototype = static_cast<FunctionAST*>(item)->prototype();
+      prototypes.try_emplace(prototype->name(), prototype);
+    } else if (item->kind() == ExprKind::Prototype) {
+      auto prototype = static_cast<PrototypeAST*>(item);
+      prototypes.try_emplace(prototype->name(), prototype);
+    }
+  }
+  TimeScope timing{"print AST"};
+  std::vector<std::string> keys(items.size());
+  ASTPrinter printer;
+  std::vector<Symbol> callees;
+  for (size_t i = 0; i < items.size(); ++i) {
+    if (items[i]->kind() != ExprKind::Function) continue;
+    printer.clear();
+    printer.visitNode(items[i]);
+    callees.clear();
+    collect_callees(items[i], callees);
+    std::sort(callees.begin(), callees.end(),
+              [](Symbol a, Symbol b) { return a.id() < b.id(); });
+    callees.erase(std::unique(callees.begin(), callees.end()),
+                  callees.end());
+    std::string content = printer.result();
+    for (Symbol callee : callees) {
+      content += "\ncalls ";
+      auto it = prototypes.find(callee);
+      if (it == prototypes.end()) {
+        content += callee.str();
+        continue;
+      }
+      printer.clear();
+      printer.visitNode(it->second);
+      content += printer.result();
+    }
+    keys[i] = hash("function", content) + ".o";
+  }
+  return keys;
+}
+
+std::string CompileCache::path(const std::string& key) const {
+  SmallString<128> path{directory_};
+  sys::path::append(path, key);
+  return std::string{path};
+}
+
+bool CompileCache::contains(const std::string& key) const {
+  return sys::fs::exists(path(key));
+}
+
+std::unique_ptr<MemoryBuffer> CompileCache::load(
+    const std::string& key) const {
+  auto buffer = MemoryBuffer::getFile(path(key), /*IsText=*/false,
+                                      /*RequiresNullTerminator=*/false);
+  if (!buffer) return nullptr;
+  return std::move(*buffer);
+}
+
+bool CompileCache::store(const std::string& key, StringRef data) {
+  if (!created_ && sys::fs::create_directories(directory_)) return false;
+  created_ = true;
+  std::string entry = path(key);
+  // private to this store, threads may store the same key at once
+  static std::atomic<uint64_t> stores{0};
+  std::string temporary = entry + "." +
+                          std::to_string(sys::Process::getProcessId()) + "." +
+                          std::to_string(stores++) + ".tmp";
+  {
+    std::error_code ec;
+    raw_fd_ostream os{temporary, ec};
+    if (ec) return false;
+    os << data;
+    os.close();
+    if (os.has_error()) {
+      os.clear_error();
+      sys::fs::remove(temporary);
+      return false;
+    }
+  }
+  // readers see a whole entry or none, even with concurrent compiles
+  if (!sys::fs::rename(temporary, entry)) return true;
+  sys::fs::remove(temporary);
+  return false;
+}
+
+std::string CompileCache::hash(std::string_view kind,
+                               std::string_view content) const {
+  std::string input = configuration_;
+  input += kind;
+  input += '\n';
+  input += content;
+  return toHex(SHA256::hash(arrayRefFromStringRef(input)),
+               /*LowerCase=*/true);
+}
+
+std::string default_cache_directory() {
+  SmallString<128> path;
+  if (const char* xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg) {
+    path = xdg;
+  } else if (const char* home = std::getenv("HOME"); home && *home) {
+    path = home;
+    sys::path::append(path, ".cache");
+  } else {
+    path = ".cache";
+  }
+  sys::path::append(path, "cata");
+  return std::string{path};
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Target/TargetMachine.h>
+
+#include "ast.h"
+#include "options.h"
+
+using namespace llvm;
+
+// Compiled code on disk, under content hashes. Whole outputs are keyed on
+// the source file, so an unchanged program skips the compiler entirely,
+// and so are the objects of files compiled separately.
+// Functions compiled on their own are keyed on their AST and the
+// prototypes they call, which is all their object code depends on, so an
+// edit only recompiles the functions it touched. Every key covers the
+// options that change code, the target and the cata binary itself, a
+// rebuilt compiler starts over.
+class CompileCache {
+ public:
+  CompileCache(std::string directory, const Options& options,
+               TargetMachine& target_machine);
+
+  // the emitted output of the source file
+  std::string output_key(std::string_view source) const;
+  // the object of a source file compiled on its own
+  std::string object_key(std::string_view source) const;
+  // one key per item, for the object code of function definitions; empty
+  // for other items
+  std::vector<std::string> function_keys(
+      std::span<ExprAST* const> items) const;
+
+  // where key is cached, if it is
+  std::string path(const std::string& key) const;
+  bool contains(const std::string& key) const;
+  // null when key is not cached
+  std::unique_ptr<MemoryBuffer> load(const std::string& key) const;
+  // false if the entry could not be written; thread safe
+  bool store(const std::string& key, StringRef data);
+
+ private:
+  std::string directory_;
+  std::atomic<bool> created_{false};
+  // hashed into every key
+  std::string configuration_;
+
+  std::string hash(std::string_view kind, std::string_view content) const;
+};
+
+// ~/.cache/cata, or under $XDG_CACHE_HOME when set
+std::string default_cache_directory();
@@ -1,269 +1,521 @@
 #include "codegen.h"
 #include "fmt.h"
+#include "timereport.h"
+
+#include <llvm/IR/DiagnosticHandler.h>
+#include <llvm/IR/DiagnosticInfo.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/Support/Regex.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/InstCombine/InstCombine.h>
+#include <llvm/Transforms/Scalar/GVN.h>
+#include <llvm/Transforms/Scalar/Reassociate.h>
+#include <llvm/Transforms/Scalar/SimplifyCFG.h>
+#include <llvm/Transforms/Utils/Mem2Reg.h>
 
 Codegen::Codegen()
     : context_{std::make_unique<LLVMContext>()},
       module_{std::make_unique<Module>("main", *context_)},
       builder_{std::make_unique<IRBuilder<>>(*context_)},
       named_values_{},
-      function_prototypes_{} {}
+      function_prototypes_{},
+      functions_{} {}
+
+namespace {
+
+// Like clang's -Rpass, -Rpass-missed and -Rpass-analysis at once. The IR
+// has no debug locations, so remarks name the function instead.
+class RemarkPrinter : public DiagnosticHandler {
+ public:
+  RemarkPrinter(const std::string& passes) : passes_{passes} {}
+
+  bool isAnalysisRemarkEnabled(StringRef pass) const override {
+    return passes_.match(pass);
+  }
+  bool isMissedOptRemarkEnabled(StringRef pass) const override {
+    return passes_.match(pass);
+  }
+  bool isPassedOptRemarkEnabled(StringRef pass) const override {
+    return passes_.match(pass);
+  }
+  bool isAnyRemarkEnabled() const override { return true; }
 
-Codegen& Codegen::instance() {
-  static Codegen codegen;
-  return codegen;
+  bool handleDiagnostics(const DiagnosticInfo& info) override {
+    auto remark = dyn_cast<DiagnosticInfoOptimizationBase>(&info);
+    // everything else gets the default handling
+    if (!remark) return false;
+    // not every remark is filtered by pass before it gets here
+    if (!passes_.match(remark->getPassName())) return true;
+    const char* kind = remark->isPassed()   ? "passed"
+                       : remark->isMissed() ? "missed"
+                                            : "analysis";
+    errs() << "remark: " << remark->getFunction().getName() << ": "
+           << remark->getPassName() << " " << kind << ": "
+           << remark->getMsg() << "\n";
+    return true;
+  }
+
+ private:
+  Regex passes_;
+};
+
+}  // namespace
+
+OptimizationLevel get_optimization_level(OptLevel level) {
+  switch (level) {
+    case OptLevel::O0:
+      return OptimizationLevel::O0;
+    case OptLevel::O1:
+      return OptimizationLevel::O1;
+    case OptLevel::O2:
+      return OptimizationLevel::O2;
+    case OptLevel::O3:
+      return OptimizationLevel::O3;
+    case OptLevel::Os:
+      return OptimizationLevel::Os;
+  }
+  error("invalid optimization level");
 }
 
-std::string Codegen::get_ir() const {
-  std::string ir;
-  raw_string_ostream os{ir};
-  module_->print(os, nullptr);
-  return os.str();
+Module& Codegen::module() {
+  return *module_;
 }
 
-Value* Codegen::visitNode(ExprAST* node) {
-  node->accept(*this);
-  return static_cast<Value*>(visit_result_);
+std::pair<std::unique_ptr<LLVMContext>, std::unique_ptr<Module>>
+Codegen::take_module() {
+  // analysis results refer to the module's functions
+  function_analyses_.clear();
+  module_analyses_.clear();
+  std::pair taken{std::move(context_), std::move(module_)};
+  context_ = std::make_unique<LLVMContext>();
+  module_ = std::make_unique<Module>("main", *context_);
+  module_->setTargetTriple(taken.second->getTargetTriple());
+  module_->setDataLayout(taken.second->getDataLayout());
+  builder_ = std::make_unique<IRBuilder<>>(*context_);
+  install_remark_printer();
+  // declarations in the old module, they are recreated on use
+  functions_.clear();
+  // and global arrays, which are only generated once
+  named_values_.clear();
+  shadowed_values_.clear();
+  return taken;
 }
 
-Function* Codegen::visitNode(PrototypeAST* node) {
-  node->accept(*this);
-  return static_cast<Function*>(visit_result_);
+void Codegen::declare(PrototypeAST* prototype) {
+  function_prototypes_.try_emplace(prototype->name(), prototype);
+}
+
+void Codegen::set_opt_level(OptLevel level, TargetMachine* target_machine) {
+  opt_level_ = level;
+  if (target_machine) {
+    module_->setTargetTriple(target_machine->getTargetTriple().str());
+    module_->setDataLayout(target_machine->createDataLayout());
+  }
+  pass_builder_ = PassBuilder{target_machine};
+  pass_builder_.registerModuleAnalyses(module_analyses_);
+  pass_builder_.registerCGSCCAnalyses(cgscc_analyses_);
+  pass_builder_.registerFunctionAnalyses(function_analyses_);
+  pass_builder_.registerLoopAnalyses(loop_analyses_);
+  pass_builder_.crossRegisterProxies(loop_analyses_, function_analyses_,
+                                     cgscc_analyses_, module_analyses_);
+  function_passes_ = FunctionPassManager{};
+  if (level == OptLevel::O0) return;
+  // cheap cleanup while the function is hot in cache, so the module
+  // pipeline starts from promoted, simplified IR
+  function_passes_.addPass(PromotePass());
+  function_passes_.addPass(InstCombinePass());
+  function_passes_.addPass(ReassociatePass());
+  function_passes_.addPass(GVNPass());
+  function_passes_.addPass(SimplifyCFGPass());
+}
+
+void Codegen::optimize() {
+  TimeScope timing{"optimize"};
+  OptimizationLevel level = get_optimization_level(opt_level_);
+  ModulePassManager module_passes =
+      level == OptimizationLevel::O0
+          ? pass_builder_.buildO0DefaultPipeline(level)
+          : pass_builder_.buildPerModuleDefaultPipeline(level);
+  // results cached by the per-function passes are not tracked by the
+  // module proxies yet
+  function_analyses_.clear();
+  module_passes.run(*module_, module_analyses_);
+}
+
+void Codegen::set_remarks(const std::string& passes) {
+  std::string message;
+  if (!Regex{passes}.isValid(message))
+    error("invalid --remarks pattern, %s", message.c_str());
+  remark_passes_ = passes;
+  install_remark_printer();
+}
+
+void Codegen::install_remark_printer() {
+  if (remark_passes_.empty()) return;
+  context_->setDiagnosticHandler(
+      std::make_unique<RemarkPrinter>(remark_passes_));
 }
 
-#define VISITOR_RETURN(value) \
-  do {                        \
-    visit_result_ = value;    \
-    return;                   \
-  } while (0)
+Function* Codegen::visitNode(PrototypeAST* node) {
+  return visitPrototypeNode(node);
+}
 
-void Codegen::visitLiteralNode(LiteralExprAST* node) {
-  VISITOR_RETURN(ConstantInt::get(*context_, APInt(32, node->value())));
+Value* Codegen::visitLiteralNode(LiteralExprAST* node) {
+  return ConstantInt::get(*context_, APInt(32, node->value()));
 }
 
-void Codegen::visitVariableNode(VariableExprAST* node) {
-  AllocaInst* alloca = get_variable(node->name());
-  if (!alloca) error("use of undeclared variable, %s", node->name().c_str());
+Value* Codegen::visitVariableNode(VariableExprAST* node) {
+  Variable variable = get_variable(node->name());
+  if (!variable.address)
+    error("use of undeclared variable, %s", node->name().str().c_str());
+  if (variable.array_size)
+    error("array %s used as a value, index it instead",
+          node->name().str().c_str());
   // load the value
-  Value* value =
-      builder_->CreateLoad(alloca->getAllocatedType(), alloca, node->name());
-  VISITOR_RETURN(value);
+  Value* value = builder_->CreateLoad(builder_->getInt32Ty(),
+                                      variable.address, node->name().str());
+  return value;
 }
 
-void Codegen::visitPrefixNode(PrefixExprAST* node) {
-  Value* operand = visitNode(node->operand().get());
-  if (!operand) VISITOR_RETURN(nullptr);
+Value* Codegen::visitPrefixNode(PrefixExprAST* node) {
+  if (node->op() == Token::Kind::Not) {
+    Value* cond = emit_condition(node);
+    if (!cond) return nullptr;
+    return builder_->CreateZExt(cond, Type::getInt32Ty(*context_));
+  }
+  Value* operand = visitNode(node->operand());
+  if (!operand) return nullptr;
   switch (node->op()) {
-    case Token::Kind::Not: {
-      Value* negated = builder_->CreateICmpEQ(
-          operand, ConstantInt::get(*context_, APInt(32, 0)), "nottmp");
-      VISITOR_RETURN(
-          builder_->CreateZExt(negated, Type::getInt32Ty(*context_)));
-    }
     case Token::Kind::Plus:
-      VISITOR_RETURN(operand);
+      return operand;
     case Token::Kind::Minus:
-      VISITOR_RETURN(builder_->CreateNeg(operand, "negtmp"));
+      return builder_->CreateNeg(operand, "negtmp");
     case Token::Kind::Tilde:
-      VISITOR_RETURN(builder_->CreateNot(operand, "nottmp"));
+      return builder_->CreateNot(operand, "nottmp");
     default:
       error("invalid prefix operator, %s",
             Token(node->op()).as_string().c_str());
   }
 }
 
-void Codegen::visitBinaryNode(BinaryExprAST* node) {
-  Value *lhs = visitNode(node->lhs().get()),
-        *rhs = visitNode(node->rhs().get());
-  if (!lhs || !rhs) VISITOR_RETURN(nullptr);
-  Value* result = nullptr;
-  switch (node->op()) {
-    case Token::Kind::Equals: {
-      VariableExprAST* lhs_var =
-          dynamic_cast<VariableExprAST*>(node->lhs().get());
-      if (!lhs_var) error("left hand side of assignment must be a variable");
-      AllocaInst* alloca = get_variable(lhs_var->name());
-      if (!alloca)
-        error("use of undeclared variable, %s", lhs_var->name().c_str());
-      builder_->CreateStore(rhs, alloca);
-      VISITOR_RETURN(rhs);
+Value* Codegen::visitBinaryNode(BinaryExprAST* node) {
+  // conditions are computed as i1, only widened for use as a value
+  if (is_condition(node)) {
+    Value* cond = emit_condition(node);
+    if (!cond) return nullptr;
+    return builder_->CreateZExt(cond, Type::getInt32Ty(*context_));
+  }
+  if (node->op() == Token::Kind::Equals) {
+    Value* address;
+    if (node->lhs()->kind() == ExprKind::Index) {
+      address = element_address(static_cast<IndexExprAST*>(node->lhs()));
+      if (!address) return nullptr;
+    } else if (node->lhs()->kind() == ExprKind::Variable) {
+      auto lhs_var = static_cast<VariableExprAST*>(node->lhs());
+      Variable variable = get_variable(lhs_var->name());
+      if (!variable.address)
+        error("use of undeclared variable, %s",
+              lhs_var->name().str().c_str());
+      if (variable.array_size)
+        error("array %s can not be assigned, assign its elements instead",
+              lhs_var->name().str().c_str());
+      address = variable.address;
+    } else {
+      error("left hand side of assignment must be a variable or an array "
+            "element");
     }
+    Value* rhs = visitNode(node->rhs());
+    if (!rhs) return nullptr;
+    builder_->CreateStore(rhs, address);
+    return rhs;
+  }
+  Value *lhs = visitNode(node->lhs()), *rhs = visitNode(node->rhs());
+  if (!lhs || !rhs) return nullptr;
+  switch (node->op()) {
     case Token::Kind::Plus:
-      VISITOR_RETURN(builder_->CreateAdd(lhs, rhs, "addtmp"));
+      return builder_->CreateAdd(lhs, rhs, "addtmp");
     case Token::Kind::Minus:
-      VISITOR_RETURN(builder_->CreateSub(lhs, rhs, "subtmp"));
+      return builder_->CreateSub(lhs, rhs, "subtmp");
     case Token::Kind::Star:
-      VISITOR_RETURN(builder_->CreateMul(lhs, rhs, "multmp"));
+      return builder_->CreateMul(lhs, rhs, "multmp");
     case Token::Kind::Slash:
-      VISITOR_RETURN(builder_->CreateSDiv(lhs, rhs, "divtmp"));
+      return builder_->CreateSDiv(lhs, rhs, "divtmp");
     case Token::Kind::Remainder:
-      VISITOR_RETURN(builder_->CreateSRem(lhs, rhs, "remtmp"));
+      return builder_->CreateSRem(lhs, rhs, "remtmp");
     // bitwise
     case Token::Kind::Ampersand:
-      VISITOR_RETURN(builder_->CreateAnd(lhs, rhs, "andtmp"));
+      return builder_->CreateAnd(lhs, rhs, "andtmp");
     case Token::Kind::Pipe:
-      VISITOR_RETURN(builder_->CreateOr(lhs, rhs, "ortmp"));
+      return builder_->CreateOr(lhs, rhs, "ortmp");
     case Token::Kind::Caret:
-      VISITOR_RETURN(builder_->CreateXor(lhs, rhs, "xortmp"));
+      return builder_->CreateXor(lhs, rhs, "xortmp");
     case Token::Kind::Tilde:
-      VISITOR_RETURN(builder_->CreateNot(rhs, "nottmp"));
+      return builder_->CreateNot(rhs, "nottmp");
     case Token::Kind::LeftShift:
-      VISITOR_RETURN(builder_->CreateShl(lhs, rhs, "shltmp"));
+      return builder_->CreateShl(lhs, rhs, "shltmp");
     case Token::Kind::RightShift:
-      VISITOR_RETURN(builder_->CreateAShr(lhs, rhs, "ashrtmp"));
-    // logical
+      return builder_->CreateAShr(lhs, rhs, "ashrtmp");
+    default:
+      error("invalid binary operator, %s",
+            Token(node->op()).as_string().c_str());
+  }
+}
+
+bool Codegen::is_condition(ExprAST* node) {
+  if (node->kind() == ExprKind::Prefix)
+    return static_cast<PrefixExprAST*>(node)->op() == Token::Kind::Not;
+  if (node->kind() != ExprKind::Binary) return false;
+  switch (static_cast<BinaryExprAST*>(node)->op()) {
     case Token::Kind::And:
-    case Token::Kind::Or: {
-      lhs = builder_->CreateICmpNE(
-          lhs, ConstantInt::get(*context_, APInt(32, 0)), "nelhs");
-      rhs = builder_->CreateICmpNE(
-          rhs, ConstantInt::get(*context_, APInt(32, 0)), "nerhs");
-      if (node->op() == Token::Kind::And) {
-        result = builder_->CreateAnd(lhs, rhs, "andtmp");
-      } else {
-        result = builder_->CreateOr(lhs, rhs, "ortmp");
-      }
-      break;
-    }
-    // comparison
+    case Token::Kind::Or:
+    case Token::Kind::Eq:
+    case Token::Kind::Ne:
+    case Token::Kind::Lt:
+    case Token::Kind::Le:
+    case Token::Kind::Gt:
+    case Token::Kind::Ge:
+      return true;
+    default:
+      return false;
+  }
+}
+
+Value* Codegen::emit_condition(ExprAST* node) {
+  if (!is_condition(node)) {
+    Value* value = visitNode(node);
+    if (!value) return nullptr;
+    return builder_->CreateICmpNE(value, builder_->getInt32(0), "tobool");
+  }
+  if (node->kind() == ExprKind::Prefix) {
+    Value* operand =
+        emit_condition(static_cast<PrefixExprAST*>(node)->operand());
+    if (!operand) return nullptr;
+    return builder_->CreateNot(operand, "nottmp");
+  }
+  auto binary = static_cast<BinaryExprAST*>(node);
+  if (binary->op() == Token::Kind::And || binary->op() == Token::Kind::Or) {
+    // the value of the branch taken without evaluating rhs
+    bool skipped = binary->op() == Token::Kind::Or;
+    Function* function = builder_->GetInsertBlock()->getParent();
+    BasicBlock *rhs_block = BasicBlock::Create(*context_, "logic.rhs"),
+               *merge_block = BasicBlock::Create(*context_, "logic.end");
+    BasicBlock* skip_block = BasicBlock::Create(*context_, "logic.skip");
+    if (!emit_branch(binary->lhs(), skipped ? skip_block : rhs_block,
+                     skipped ? rhs_block : skip_block))
+      return nullptr;
+    function->insert(function->end(), skip_block);
+    builder_->SetInsertPoint(skip_block);
+    builder_->CreateBr(merge_block);
+    function->insert(function->end(), rhs_block);
+    builder_->SetInsertPoint(rhs_block);
+    Value* rhs = emit_condition(binary->rhs());
+    if (!rhs) return nullptr;
+    builder_->CreateBr(merge_block);
+    rhs_block = builder_->GetInsertBlock();
+    function->insert(function->end(), merge_block);
+    builder_->SetInsertPoint(merge_block);
+    PHINode* phi = builder_->CreatePHI(builder_->getInt1Ty(), 2, "logictmp");
+    phi->addIncoming(builder_->getInt1(skipped), skip_block);
+    phi->addIncoming(rhs, rhs_block);
+    return phi;
+  }
+  Value *lhs = visitNode(binary->lhs()), *rhs = visitNode(binary->rhs());
+  if (!lhs || !rhs) return nullptr;
+  switch (binary->op()) {
     case Token::Kind::Eq:
-      result = builder_->CreateICmpEQ(lhs, rhs, "eqtmp");
-      break;
+      return builder_->CreateICmpEQ(lhs, rhs, "eqtmp");
     case Token::Kind::Ne:
-      result = builder_->CreateICmpNE(lhs, rhs, "netmp");
-      break;
+      return builder_->CreateICmpNE(lhs, rhs, "netmp");
     case Token::Kind::Lt:
-      result = builder_->CreateICmpSLT(lhs, rhs, "lttmp");
-      break;
+      return builder_->CreateICmpSLT(lhs, rhs, "lttmp");
     case Token::Kind::Le:
-      result = builder_->CreateICmpSLE(lhs, rhs, "letmp");
-      break;
+      return builder_->CreateICmpSLE(lhs, rhs, "letmp");
     case Token::Kind::Gt:
-      result = builder_->CreateICmpSGT(lhs, rhs, "gttmp");
-      break;
+      return builder_->CreateICmpSGT(lhs, rhs, "gttmp");
     case Token::Kind::Ge:
-      result = builder_->CreateICmpSGE(lhs, rhs, "getmp");
-      break;
+      return builder_->CreateICmpSGE(lhs, rhs, "getmp");
     default:
       error("invalid binary operator, %s",
-            Token(node->op()).as_string().c_str());
+            Token(binary->op()).as_string().c_str());
+  }
+}
+
+bool Codegen::emit_branch(ExprAST* node, BasicBlock* if_true,
+                          BasicBlock* if_false) {
+  if (node->kind() == ExprKind::Prefix &&
+      static_cast<PrefixExprAST*>(node)->op() == Token::Kind::Not)
+    return emit_branch(static_cast<PrefixExprAST*>(node)->operand(), if_false,
+                       if_true);
+  auto binary = static_cast<BinaryExprAST*>(node);
+  if (node->kind() == ExprKind::Binary &&
+      (binary->op() == Token::Kind::And || binary->op() == Token::Kind::Or)) {
+    // the rhs only runs when the lhs did not decide
+    Function* function = builder_->GetInsertBlock()->getParent();
+    BasicBlock* rhs_block = BasicBlock::Create(*context_, "logic.rhs");
+    bool is_and = binary->op() == Token::Kind::And;
+    if (!emit_branch(binary->lhs(), is_and ? rhs_block : if_true,
+                     is_and ? if_false : rhs_block))
+      return false;
+    function->insert(function->end(), rhs_block);
+    builder_->SetInsertPoint(rhs_block);
+    return emit_branch(binary->rhs(), if_true, if_false);
+  }
+  Value* cond = emit_condition(node);
+  if (!cond) return false;
+  if (auto constant = dyn_cast<ConstantInt>(cond)) {
+    builder_->CreateBr(constant->isOne() ? if_true : if_false);
+  } else {
+    builder_->CreateCondBr(cond, if_true, if_false);
   }
-  // extend the result to 32 bits
-  VISITOR_RETURN(builder_->CreateZExt(result, Type::getInt32Ty(*context_)));
+  return true;
 }
 
-void Codegen::visitBlockNode(BlockExprAST* node) {
+Value* Codegen::visitBlockNode(BlockExprAST* node) {
   Value* last_value = nullptr;
-  for (auto& expr : node->exprs()) {
-    last_value = visitNode(expr.get());
-    if (!last_value) VISITOR_RETURN(nullptr);
+  for (ExprAST* expr : node->exprs()) {
+    last_value = visitNode(expr);
+    if (!last_value) return nullptr;
   }
-  VISITOR_RETURN(last_value);
+  return last_value;
 }
 
-void Codegen::visitCallNode(CallExprAST* node) {
+Value* Codegen::visitCallNode(CallExprAST* node) {
+  PrototypeAST* prototype = nullptr;
+  if (auto it = function_prototypes_.find(node->callee());
+      it != function_prototypes_.end())
+    prototype = it->second;
   std::vector<Value*> args;
   for (size_t i = 0; i < node->args().size(); ++i) {
-    args.push_back(visitNode(node->args()[i].get()));
-    if (!args.back()) VISITOR_RETURN(nullptr);
+    uint32_t array_size = prototype && i < prototype->args().size()
+                              ? prototype->array_size(i)
+                              : 0;
+    args.push_back(array_size ? array_argument(node, i, array_size)
+                              : visitNode(node->args()[i]));
+    if (!args.back()) return nullptr;
   }
   std::vector<Type*> arg_types(args.size());
   for (size_t i = 0; i < args.size(); ++i) {
     arg_types[i] = args[i]->getType();
   }
   Function* callee = get_function(node->callee(), arg_types, true);
-  if (!callee) error("called undefined function, %s", node->callee().c_str());
+  if (!callee)
+    error("called undefined function, %s", node->callee().str().c_str());
   if (callee->arg_size() != node->args().size())
     error("function %s expects %lu arguments, but got %lu",
-          node->callee().c_str(), callee->arg_size(), node->args().size());
-  VISITOR_RETURN(builder_->CreateCall(callee, args, "calltmp"));
+          node->callee().str().c_str(), callee->arg_size(),
+          node->args().size());
+  return builder_->CreateCall(callee, args, "calltmp");
 }
 
 // TODO: overwrite? previous prototype if it exists
-void Codegen::visitPrototypeNode(PrototypeAST* node) {
-  std::vector<Type*> arg_types(node->args().size(),
-                               Type::getInt32Ty(*context_));
-  FunctionType* function_type =
-      FunctionType::get(Type::getInt32Ty(*context_), arg_types, false);
-  Function* function = Function::Create(
-      function_type, Function::ExternalLinkage, node->name(), module_.get());
+Function* Codegen::visitPrototypeNode(PrototypeAST* node) {
+  FunctionType* function_type = FunctionType::get(
+      Type::getInt32Ty(*context_), get_arg_types(node), false);
+  Function* function =
+      Function::Create(function_type, Function::ExternalLinkage,
+                       node->name().str(), module_.get());
   size_t i = 0;
   for (auto& arg : function->args()) {
-    arg.setName(node->args()[i++]);
+    arg.setName(node->args()[i].str());
+    // callers pass distinct arrays that are large enough, see
+    // array_argument
+    if (uint32_t size = node->array_size(i)) {
+      arg.addAttr(Attribute::NoAlias);
+      arg.addAttr(Attribute::NoCapture);
+      arg.addAttr(Attribute::getWithDereferenceableBytes(
+          *context_, uint64_t{size} * sizeof(int32_t)));
+      arg.addAttr(Attribute::getWithAlignment(*context_, Align(4)));
+    }
+    ++i;
   }
-  VISITOR_RETURN(function);
+  functions_.try_emplace(node->name(), function);
+  // calls need the array parameters of declared functions
+  function_prototypes_.try_emplace(node->name(), node);
+  return function;
 }
 
-void Codegen::visitFunctionNode(FunctionAST* node) {
+Value* Codegen::visitFunctionNode(FunctionAST* node) {
+  TimeScope timing{"codegen", node->prototype()->name()};
   auto& prototype = *node->prototype();
-  // Assuming int32 for now
-  std::vector<Type*> arg_types(prototype.args().size(),
-                               Type::getInt32Ty(*context_));
+  std::vector<Type*> arg_types = get_arg_types(&prototype);
   Function* function =
       get_function(node->prototype()->name(), arg_types, false);
-  if (!function) function = visitNode(node->prototype().get());
-  if (!function) VISITOR_RETURN(nullptr);
+  if (!function) function = visitNode(node->prototype());
+  if (!function) return nullptr;
   for (size_t i = 0; i < function->arg_size(); ++i) {
-    if (function->getArg(i)->getName() != prototype.args()[i])
+    if (function->getArg(i)->getName() != prototype.args()[i].str())
       // the prototype is the "header" of this function, so the argument name
       // and prototype name are reversed
       error(
           "argument name, %s, does not match prototype, %s, in function %s "
           "argument %lu",
-          prototype.args()[i].c_str(),
+          prototype.args()[i].str().c_str(),
           function->getArg(i)->getName().str().c_str(),
-          prototype.name().c_str(), i + 1);
+          prototype.name().str().c_str(), i + 1);
   }
-  function_prototypes_[prototype.name()] = std::move(node->prototype());
+  function_prototypes_[prototype.name()] = node->prototype();
   function = get_function(prototype.name(), arg_types, true);
   if (!function)
-    error("failed to create function, %s", prototype.name().c_str());
+    error("failed to create function, %s", prototype.name().str().c_str());
   BasicBlock* basic_block = BasicBlock::Create(*context_, "entry", function);
   builder_->SetInsertPoint(basic_block);
   begin_scope();
   for (auto& arg : function->args()) {
-    arg.setName(prototype.args()[arg.getArgNo()]);
+    Symbol name = prototype.args()[arg.getArgNo()];
+    arg.setName(name.str());
+    // arrays are passed by address
+    if (uint32_t size = prototype.array_size(arg.getArgNo())) {
+      set_variable(name, {&arg, size});
+      continue;
+    }
     // store the argument in an alloca at the beginning of the function
-    IRBuilder<> tmp_builder(basic_block);
-    AllocaInst* alloca = tmp_builder.CreateAlloca(Type::getInt32Ty(*context_),
-                                                  nullptr, arg.getName());
-    tmp_builder.CreateStore(&arg, alloca);
-    set_variable(std::string(arg.getName()), alloca);
+    AllocaInst* alloca = create_entry_block_alloca(function, name);
+    builder_->CreateStore(&arg, alloca);
+    set_variable(name, {alloca});
   }
-  if (Value* ret = visitNode(node->body().get())) {
+  if (node->memoize()) emit_memo_lookup(function);
+  Value* ret = visitNode(node->body());
+  end_scope();
+  if (ret) {
+    if (node->memoize()) emit_memo_store(ret);
     builder_->CreateRet(ret);
-    verifyFunction(*function);
-    // TODO: optimize function
-    VISITOR_RETURN(function);
+    {
+      TimeScope timing{"verify"};
+      verifyFunction(*function);
+    }
+    {
+      TimeScope timing{"optimize"};
+      function_passes_.run(*function, function_analyses_);
+    }
+    return function;
   }
+  functions_.erase(prototype.name());
   function->eraseFromParent();
-  VISITOR_RETURN(nullptr);
+  return nullptr;
 }
 
-void Codegen::visitLetNode(LetExprAST* node) {
-  Value* value = visitNode(node->expr().get());
-  if (!value) VISITOR_RETURN(nullptr);
-  AllocaInst* alloca = builder_->CreateAlloca(Type::getInt32Ty(*context_),
-                                              nullptr, node->name());
+Value* Codegen::visitLetNode(LetExprAST* node) {
+  Value* value = visitNode(node->expr());
+  if (!value) return nullptr;
+  Function* function = builder_->GetInsertBlock()->getParent();
+  AllocaInst* alloca = create_entry_block_alloca(function, node->name());
   builder_->CreateStore(value, alloca);
-  set_variable(node->name(), alloca);
-  VISITOR_RETURN(value);
+  set_variable(node->name(), {alloca});
+  return value;
 }
 
-void Codegen::visitIfNode(IfExprAST* node) {
-  Value* cond = visitNode(node->condition().get());
-  if (!cond) VISITOR_RETURN(nullptr);
-  cond = builder_->CreateICmpNE(cond, ConstantInt::get(*context_, APInt(32, 0)),
-                                "ifcond");
+Value* Codegen::visitIfNode(IfExprAST* node) {
   Function* function = builder_->GetInsertBlock()->getParent();
-  BasicBlock *then_block = BasicBlock::Create(*context_, "then", function),
+  BasicBlock *then_block = BasicBlock::Create(*context_, "then"),
              *else_block = BasicBlock::Create(*context_, "else"),
              *merge_block = BasicBlock::Create(*context_, "ifcont");
-  builder_->CreateCondBr(cond, then_block, else_block);
+  if (!emit_branch(node->condition(), then_block, else_block)) return nullptr;
+  function->insert(function->end(), then_block);
   builder_->SetInsertPoint(then_block);
   begin_scope();
-  Value* then_value = visitNode(node->then_expr().get());
+  Value* then_value = visitNode(node->then_expr());
   end_scope();
-  if (!then_value) VISITOR_RETURN(nullptr);
+  if (!then_value) return nullptr;
   builder_->CreateBr(merge_block);
   then_block = builder_->GetInsertBlock();
   function->insert(function->end(), else_block);
@@ -271,9 +523,9 @@ void Codegen::visitIfNode(IfExprAST* node) {
   Value* else_value = nullptr;
   if (node->else_expr()) {
     begin_scope();
-    else_value = visitNode(node->else_expr().get());
+    else_value = visitNode(node->else_expr());
     end_scope();
-    if (!else_value) VISITOR_RETURN(nullptr);
+    if (!else_value) return nullptr;
   }
   builder_->CreateBr(merge_block);
   else_block = builder_->GetInsertBlock();
@@ -288,48 +540,357 @@ void Codegen::visitIfNode(IfExprAST* node) {
     phi_node->addIncoming(ConstantInt::get(*context_, APInt(32, 0)),
                           else_block);
   }
-  VISITOR_RETURN(phi_node);
+  return phi_node;
+}
+
+// Loops come out already rotated and in loop simplify form, the shape the
+// loop passes expect: a guard, a preheader, the body as header, one latch
+// testing the condition again, and a dedicated exit. The step and the
+// condition are evaluated before the latch, so even a short-circuit
+// condition leaves the latch the only block branching back. Loop-carried
+// variables are entry block allocas like any other, mem2reg turns them
+// into header phis.
+Value* Codegen::visitLoopNode(LoopExprAST* node) {
+  Function* function = builder_->GetInsertBlock()->getParent();
+  // the loop is a scope for its init, the body one for each iteration
+  Scope loop_scope{*this};
+  if (node->init() && !visitNode(node->init())) return nullptr;
+  BasicBlock *preheader = BasicBlock::Create(*context_, "loop.preheader"),
+             *body = BasicBlock::Create(*context_, "loop.body"),
+             *step = BasicBlock::Create(*context_, "loop.step"),
+             *latch = BasicBlock::Create(*context_, "loop.latch"),
+             *exit = BasicBlock::Create(*context_, "loop.exit"),
+             *end = BasicBlock::Create(*context_, "loop.end");
+  if (node->condition()) {
+    if (!emit_branch(node->condition(), preheader, end)) return nullptr;
+  } else {
+    builder_->CreateBr(preheader);
+  }
+  function->insert(function->end(), preheader);
+  builder_->SetInsertPoint(preheader);
+  builder_->CreateBr(body);
+  function->insert(function->end(), body);
+  builder_->SetInsertPoint(body);
+  {
+    Scope body_scope{*this};
+    if (!is_empty_block(node->body()) && !visitNode(node->body()))
+      return nullptr;
+  }
+  builder_->CreateBr(step);
+  function->insert(function->end(), step);
+  builder_->SetInsertPoint(step);
+  if (node->step() && !visitNode(node->step())) return nullptr;
+  Value* cond = node->condition() ? emit_condition(node->condition())
+                                  : builder_->getTrue();
+  if (!cond) return nullptr;
+  builder_->CreateBr(latch);
+  function->insert(function->end(), latch);
+  builder_->SetInsertPoint(latch);
+  auto constant = dyn_cast<ConstantInt>(cond);
+  if (constant && constant->isZero()) {
+    builder_->CreateBr(exit);
+  } else {
+    Instruction* back_edge = constant
+                                 ? builder_->CreateBr(body)
+                                 : builder_->CreateCondBr(cond, body, exit);
+    // the loop's ID, on its only back edge, for the hints loop passes leave
+    MDNode* loop_id = MDNode::getDistinct(*context_, {nullptr});
+    loop_id->replaceOperandWith(0, loop_id);
+    back_edge->setMetadata(LLVMContext::MD_loop, loop_id);
+  }
+  function->insert(function->end(), exit);
+  builder_->SetInsertPoint(exit);
+  builder_->CreateBr(end);
+  function->insert(function->end(), end);
+  builder_->SetInsertPoint(end);
+  return builder_->getInt32(0);
+}
+
+Value* Codegen::visitArrayNode(ArrayExprAST* node) {
+  ArrayType* type = ArrayType::get(builder_->getInt32Ty(), node->size());
+  if (node->global()) {
+    // llvm would rename a second one rather than refuse it
+    if (isa_and_nonnull<GlobalVariable>(get_variable(node->name()).address))
+      error("redefinition of array, %s", node->name().str().c_str());
+    auto global = new GlobalVariable(*module_, type, false,
+                                     GlobalValue::InternalLinkage,
+                                     ConstantAggregateZero::get(type),
+                                     node->name().str());
+    global->setAlignment(Align(16));
+    set_variable(node->name(), {global, node->size()});
+    return global;
+  }
+  Function* function = builder_->GetInsertBlock()->getParent();
+  AllocaInst* alloca =
+      create_entry_block_alloca(function, node->name(), type);
+  alloca->setAlignment(Align(16));
+  // zeroed each time the let runs, like a fresh variable
+  builder_->CreateMemSet(alloca, builder_->getInt8(0),
+                         uint64_t{node->size()} * sizeof(int32_t),
+                         alloca->getAlign());
+  set_variable(node->name(), {alloca, node->size()});
+  return builder_->getInt32(0);
+}
+
+Value* Codegen::visitIndexNode(IndexExprAST* node) {
+  Value* address = element_address(node);
+  if (!address) return nullptr;
+  return builder_->CreateLoad(builder_->getInt32Ty(), address,
+                              node->array().str() + ".elt");
+}
+
+Value* Codegen::element_address(IndexExprAST* node) {
+  Variable array = get_variable(node->array());
+  if (!array.address)
+    error("use of undeclared array, %s", node->array().str().c_str());
+  if (!array.array_size)
+    error("%s is not an array", node->array().str().c_str());
+  Value* index = visitNode(node->index());
+  if (!index) return nullptr;
+  Value* size = builder_->getInt32(array.array_size);
+  // a constant index in range needs no check, one out of range fails only
+  // if it runs, it may be guarded
+  auto constant = dyn_cast<ConstantInt>(index);
+  if (!constant || constant->getZExtValue() >= array.array_size) {
+    Function* function = builder_->GetInsertBlock()->getParent();
+    BasicBlock* fail = BasicBlock::Create(*context_, "bounds.fail", function);
+    BasicBlock* ok = BasicBlock::Create(*context_, "bounds.ok", function);
+    // unsigned, so negative indices fail too
+    builder_->CreateCondBr(builder_->CreateICmpULT(index, size), ok, fail,
+                           MDBuilder(*context_).createBranchWeights(
+                               (1U << 20) - 1, 1));
+    builder_->SetInsertPoint(fail);
+    FunctionCallee bounds_fail = module_->getOrInsertFunction(
+        "cata_bounds_fail",
+        FunctionType::get(builder_->getVoidTy(),
+                          {builder_->getInt32Ty(), builder_->getInt32Ty()},
+                          false));
+    if (auto declaration = dyn_cast<Function>(bounds_fail.getCallee())) {
+      declaration->setDoesNotReturn();
+      declaration->setDoesNotThrow();
+      declaration->addFnAttr(Attribute::Cold);
+    }
+    builder_->CreateCall(bounds_fail, {index, size});
+    builder_->CreateUnreachable();
+    builder_->SetInsertPoint(ok);
+  }
+  // indices are unsigned once checked
+  return builder_->CreateInBoundsGEP(
+      builder_->getInt32Ty(), array.address,
+      builder_->CreateZExt(index, builder_->getInt64Ty()),
+      node->array().str() + ".addr");
+}
+
+Value* Codegen::array_argument(CallExprAST* node, size_t i, uint32_t size) {
+  ExprAST* arg = node->args()[i];
+  const char* callee = node->callee().str().c_str();
+  if (arg->kind() != ExprKind::Variable)
+    error("function %s argument %lu must be an array", callee, i + 1);
+  Symbol name = static_cast<VariableExprAST*>(arg)->name();
+  Variable array = get_variable(name);
+  if (!array.array_size)
+    error("function %s argument %lu must be an array", callee, i + 1);
+  if (array.array_size < size)
+    error("array %s has %u elements, %s expects %u", name.str().c_str(),
+          array.array_size, callee, size);
+  // array parameters are noalias, which holds while every array argument
+  // is a distinct local
+  if (isa<GlobalVariable>(array.address))
+    error("global array %s can not be passed to %s, use it directly",
+          name.str().c_str(), callee);
+  for (size_t j = 0; j < i; ++j) {
+    ExprAST* other = node->args()[j];
+    if (other->kind() == ExprKind::Variable &&
+        static_cast<VariableExprAST*>(other)->name() == name)
+      error("array %s passed to %s twice, array arguments may not alias",
+            name.str().c_str(), callee);
+  }
+  return array.address;
+}
+
+std::vector<Type*> Codegen::get_arg_types(PrototypeAST* prototype) {
+  std::vector<Type*> arg_types;
+  for (size_t i = 0; i < prototype->args().size(); ++i) {
+    if (prototype->array_size(i)) {
+      arg_types.push_back(builder_->getPtrTy());
+    } else {
+      arg_types.push_back(builder_->getInt32Ty());
+    }
+  }
+  return arg_types;
+}
+
+AllocaInst* Codegen::create_entry_block_alloca(Function* function,
+                                               Symbol name, Type* type) {
+  BasicBlock& entry = function->getEntryBlock();
+  IRBuilder<> tmp_builder(&entry, entry.begin());
+  return tmp_builder.CreateAlloca(type ? type : Type::getInt32Ty(*context_),
+                                  nullptr, name.str());
+}
+
+namespace {
+
+// arguments below this are cached in a plain array, one argument only
+constexpr uint32_t memo_direct_size = 1024;
+
+FunctionCallee get_memo_function(Module& module, const char* name,
+                                 Type* last_arg_type) {
+  LLVMContext& context = module.getContext();
+  Type* i32 = Type::getInt32Ty(context);
+  Type* ptr = PointerType::getUnqual(context);
+  bool lookup = last_arg_type->isPointerTy();
+  return module.getOrInsertFunction(
+      name, FunctionType::get(lookup ? i32 : Type::getVoidTy(context),
+                              {ptr, ptr, i32, last_arg_type}, false));
+}
+
+}  // namespace
+
+// The memo table is a runtime hash table keyed on every argument, see
+// ir/lib.c. Functions of one argument check an array first, which covers
+// the small arguments recursion usually bottoms out in.
+void Codegen::emit_memo_lookup(Function* function) {
+  Type* i32 = builder_->getInt32Ty();
+  Type* ptr = builder_->getPtrTy();
+  std::string name = function->getName().str();
+  unsigned arg_count = function->arg_size();
+  memo_ = {};
+  memo_.table = new GlobalVariable(
+      *module_, ptr, false, GlobalValue::InternalLinkage,
+      ConstantPointerNull::get(builder_->getPtrTy()), name + ".memo");
+  ArrayType* keys_type = ArrayType::get(i32, arg_count);
+  memo_.keys = builder_->CreateAlloca(keys_type, nullptr, "memo.keys");
+  for (Argument& arg : function->args()) {
+    builder_->CreateStore(
+        &arg, builder_->CreateConstInBoundsGEP2_32(keys_type, memo_.keys, 0,
+                                                   arg.getArgNo()));
+  }
+  AllocaInst* found = builder_->CreateAlloca(i32, nullptr, "memo.value");
+  BasicBlock* hashed = BasicBlock::Create(*context_, "memo.hashed", function);
+  BasicBlock* hit = BasicBlock::Create(*context_, "memo.hit", function);
+  BasicBlock* miss = BasicBlock::Create(*context_, "memo.miss", function);
+  if (arg_count == 1) {
+    ArrayType* values_type = ArrayType::get(i32, memo_direct_size);
+    ArrayType* valid_type =
+        ArrayType::get(builder_->getInt8Ty(), memo_direct_size);
+    memo_.values = new GlobalVariable(
+        *module_, values_type, false, GlobalValue::InternalLinkage,
+        ConstantAggregateZero::get(values_type), name + ".memo.values");
+    memo_.valid = new GlobalVariable(
+        *module_, valid_type, false, GlobalValue::InternalLinkage,
+        ConstantAggregateZero::get(valid_type), name + ".memo.valid");
+    BasicBlock* direct = BasicBlock::Create(*context_, "memo.direct", function);
+    BasicBlock* direct_hit =
+        BasicBlock::Create(*context_, "memo.direct.hit", function);
+    Value* arg = function->getArg(0);
+    // negative arguments are out of range too
+    builder_->CreateCondBr(
+        builder_->CreateICmpULT(arg, builder_->getInt32(memo_direct_size)),
+        direct, hashed);
+    builder_->SetInsertPoint(direct);
+    Value* valid = builder_->CreateLoad(
+        builder_->getInt8Ty(),
+        builder_->CreateInBoundsGEP(valid_type, memo_.valid,
+                                    {builder_->getInt32(0), arg}));
+    // small arguments are only ever stored directly
+    builder_->CreateCondBr(builder_->CreateIsNotNull(valid), direct_hit,
+                           miss);
+    builder_->SetInsertPoint(direct_hit);
+    builder_->CreateRet(builder_->CreateLoad(
+        i32, builder_->CreateInBoundsGEP(values_type, memo_.values,
+                                         {builder_->getInt32(0), arg})));
+  } else {
+    builder_->CreateBr(hashed);
+  }
+  builder_->SetInsertPoint(hashed);
+  Value* is_hit = builder_->CreateCall(
+      get_memo_function(*module_, "cata_memo_lookup", ptr),
+      {memo_.table, memo_.keys, builder_->getInt32(arg_count), found});
+  builder_->CreateCondBr(builder_->CreateIsNotNull(is_hit), hit, miss);
+  builder_->SetInsertPoint(hit);
+  builder_->CreateRet(builder_->CreateLoad(i32, found));
+  builder_->SetInsertPoint(miss);
+}
+
+void Codegen::emit_memo_store(Value* value) {
+  Function* function = builder_->GetInsertBlock()->getParent();
+  unsigned arg_count = function->arg_size();
+  BasicBlock* hashed = BasicBlock::Create(*context_, "memo.store", function);
+  BasicBlock* done = BasicBlock::Create(*context_, "memo.done", function);
+  if (memo_.values) {
+    BasicBlock* direct =
+        BasicBlock::Create(*context_, "memo.store.direct", function);
+    Value* arg = function->getArg(0);
+    builder_->CreateCondBr(
+        builder_->CreateICmpULT(arg, builder_->getInt32(memo_direct_size)),
+        direct, hashed);
+    builder_->SetInsertPoint(direct);
+    Value* zero = builder_->getInt32(0);
+    builder_->CreateStore(
+        value, builder_->CreateInBoundsGEP(memo_.values->getValueType(),
+                                           memo_.values, {zero, arg}));
+    builder_->CreateStore(
+        builder_->getInt8(1),
+        builder_->CreateInBoundsGEP(memo_.valid->getValueType(), memo_.valid,
+                                    {zero, arg}));
+    builder_->CreateBr(done);
+  } else {
+    builder_->CreateBr(hashed);
+  }
+  builder_->SetInsertPoint(hashed);
+  builder_->CreateCall(
+      get_memo_function(*module_, "cata_memo_store", builder_->getInt32Ty()),
+      {memo_.table, memo_.keys, builder_->getInt32(arg_count), value});
+  builder_->CreateBr(done);
+  builder_->SetInsertPoint(done);
 }
 
 void Codegen::begin_scope() {
-  named_values_.push_back({});
+  scopes_.push_back(shadowed_values_.size());
 }
 
 void Codegen::end_scope() {
-  named_values_.pop_back();
+  // undo the scope's bindings in reverse, uncovering shadowed variables
+  while (shadowed_values_.size() > scopes_.back()) {
+    auto [name, variable] = shadowed_values_.back();
+    named_values_[name.id()] = variable;
+    shadowed_values_.pop_back();
+  }
+  scopes_.pop_back();
 }
 
-AllocaInst* Codegen::get_variable(const std::string& name) {
-  // variables can be shadowed, so we start searching from the top
-  for (auto it = named_values_.rbegin(); it != named_values_.rend(); ++it) {
-    if (auto value = it->find(name); value != it->end()) return value->second;
-  }
-  return nullptr;
+Codegen::Variable Codegen::get_variable(Symbol name) {
+  if (name.id() >= named_values_.size()) return {};
+  return named_values_[name.id()];
 }
 
-void Codegen::set_variable(const std::string& name, AllocaInst* alloca) {
-  named_values_.back()[name] = alloca;
+void Codegen::set_variable(Symbol name, Variable variable) {
+  if (name.id() >= named_values_.size())
+    named_values_.resize(name.id() + 1);
+  shadowed_values_.emplace_back(name, named_values_[name.id()]);
+  named_values_[name.id()] = variable;
 }
 
-Function* Codegen::get_function(const std::string& name,
+Function* Codegen::get_function(Symbol name,
                                 const std::vector<Type*>& arg_types,
                                 bool expect_declared) {
-  if (Function* function = module_->getFunction(name)) {
+  if (auto it = functions_.find(name); it != functions_.end()) {
+    Function* function = it->second;
     if (!expect_declared && !function->empty())
-      error("redefinition of function, %s", name.c_str());
+      error("redefinition of function, %s", name.str().c_str());
     if (function->arg_size() != arg_types.size())
-      error("function %s expects %lu arguments, but got %lu", name.c_str(),
-            function->arg_size(), arg_types.size());
+      error("function %s expects %lu arguments, but got %lu",
+            name.str().c_str(), function->arg_size(), arg_types.size());
     for (size_t i = 0; i < arg_types.size(); ++i) {
       if (function->getArg(i)->getType() != arg_types[i])
-        error("function %s argument %lu type mismatch", name.c_str(), i + 1);
+        error("function %s argument %lu type mismatch", name.str().c_str(),
+              i + 1);
     }
     return function;
   }
-  if (std::unique_ptr<PrototypeAST>& prototype = function_prototypes_[name]) {
-    return visitNode(prototype.get());
+  if (auto it = function_prototypes_.find(name);
+      it != function_prototypes_.end()) {
+    return visitNode(it->second);
   }
   return nullptr;
 }
-
-#undef VISITOR_RETURN
@@ -1,7 +1,8 @@
 #pragma once
 
-#include <map>
 #include <memory>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <llvm/ADT/APFloat.h>
@@ -15,51 +16,147 @@
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Type.h>
 #include <llvm/IR/Verifier.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Target/TargetMachine.h>
 
 #include "ast.h"
+#include "options.h"
 
 using namespace llvm;
 
-class Codegen : ASTNodeVisitor {
+class Codegen : ASTVisitor<Codegen, Value*> {
  public:
+  // generators share nothing, each has a context of its own, so several
+  // can run on different threads
+  Codegen();
   Codegen(Codegen const&) = delete;
   Codegen& operator=(Codegen const&) = delete;
 
-  static Codegen& instance();
+  Module& module();
+  // hands the generated module, and the context it lives in, to the caller;
+  // later code goes to a new module for the same target
+  std::pair<std::unique_ptr<LLVMContext>, std::unique_ptr<Module>>
+  take_module();
+  // makes a function callable before its definition is generated
+  void declare(PrototypeAST* prototype);
 
-  std::string get_ir() const;
+  // selects the pipelines run on each function as it is generated, and on
+  // the whole module by optimize(); passes tune for target_machine if set
+  void set_opt_level(OptLevel level, TargetMachine* target_machine = nullptr);
+  void optimize();
+  // prints optimization remarks of the passes matching the regex to
+  // stderr, for this module and every one taken after it
+  void set_remarks(const std::string& passes);
 
-  Value* visitNode(ExprAST* node);
+  using ASTVisitor::visitNode;
   Function* visitNode(PrototypeAST* node);
 
  private:
-  void* visit_result_;
+  friend class ASTVisitor;
+
   std::unique_ptr<LLVMContext> context_;
   std::unique_ptr<Module> module_;
   std::unique_ptr<IRBuilder<>> builder_;
-  std::vector<std::map<std::string, AllocaInst*>> named_values_;
-  std::map<std::string, std::unique_ptr<PrototypeAST>> function_prototypes_;
+  struct Variable {
+    // the alloca of a scalar, the first element of an array
+    Value* address = nullptr;
+    // 0 for scalars
+    uint32_t array_size = 0;
+  };
+  // innermost binding of every variable, indexed by symbol id, so only as
+  // large as the program's names
+  std::vector<Variable> named_values_;
+  // bindings hidden by set_variable, restored when their scope ends
+  std::vector<std::pair<Symbol, Variable>> shadowed_values_;
+  // size of shadowed_values_ when each open scope began
+  std::vector<size_t> scopes_;
+  std::unordered_map<Symbol, PrototypeAST*> function_prototypes_;
+  std::unordered_map<Symbol, Function*> functions_;
 
-  Codegen();
+  OptLevel opt_level_{OptLevel::O0};
+  // empty when remarks are off
+  std::string remark_passes_;
+  PassBuilder pass_builder_;
+  // declared in this order so they are destroyed in the right order, and
+  // before the module they hold results for
+  LoopAnalysisManager loop_analyses_;
+  FunctionAnalysisManager function_analyses_;
+  CGSCCAnalysisManager cgscc_analyses_;
+  ModuleAnalysisManager module_analyses_;
+  FunctionPassManager function_passes_;
+
+  // memo table of the @memo function being generated
+  struct MemoTable {
+    GlobalVariable* table = nullptr;
+    // direct mapped cache of small arguments, one argument functions only
+    GlobalVariable* values = nullptr;
+    GlobalVariable* valid = nullptr;
+    AllocaInst* keys = nullptr;
+  };
+  MemoTable memo_;
+
+  Value* visitLiteralNode(LiteralExprAST* node);
+  Value* visitVariableNode(VariableExprAST* node);
+  Value* visitPrefixNode(PrefixExprAST* node);
+  Value* visitBinaryNode(BinaryExprAST* node);
+  Value* visitBlockNode(BlockExprAST* node);
+  Value* visitCallNode(CallExprAST* node);
+  Function* visitPrototypeNode(PrototypeAST* node);
+  Value* visitFunctionNode(FunctionAST* node);
+  Value* visitLetNode(LetExprAST* node);
+  Value* visitIfNode(IfExprAST* node);
+  Value* visitLoopNode(LoopExprAST* node);
+  Value* visitArrayNode(ArrayExprAST* node);
+  Value* visitIndexNode(IndexExprAST* node);
+
+  void install_remark_printer();
 
-  void visitLiteralNode(LiteralExprAST* node) override;
-  void visitVariableNode(VariableExprAST* node) override;
-  void visitPrefixNode(PrefixExprAST* node) override;
-  void visitBinaryNode(BinaryExprAST* node) override;
-  void visitBlockNode(BlockExprAST* node) override;
-  void visitCallNode(CallExprAST* node) override;
-  void visitPrototypeNode(PrototypeAST* node) override;
-  void visitFunctionNode(FunctionAST* node) override;
-  void visitLetNode(LetExprAST* node) override;
-  void visitIfNode(IfExprAST* node) override;
+  // Conditions: comparisons and the logical operators, which are computed
+  // as i1. && and || only evaluate their rhs when the lhs does not decide.
+  static bool is_condition(ExprAST* node);
+  Value* emit_condition(ExprAST* node);
+  // branches on node, without materializing an i1 for && and || chains;
+  // false if generating node failed
+  bool emit_branch(ExprAST* node, BasicBlock* if_true, BasicBlock* if_false);
+
+  // allocas go to the entry block, where mem2reg and SROA can promote them;
+  // an i32 unless type is given
+  AllocaInst* create_entry_block_alloca(Function* function, Symbol name,
+                                        Type* type = nullptr);
+
+  // Arrays. Indices are checked against the size, unless constant; checks
+  // in loops the optimizer proves in bounds, and can then vectorize.
+  Value* element_address(IndexExprAST* node);
+  // the address of argument i, which must be an array of at least size
+  Value* array_argument(CallExprAST* node, size_t i, uint32_t size);
+  std::vector<Type*> get_arg_types(PrototypeAST* prototype);
+
+  // returns early when the arguments are in the memo table
+  void emit_memo_lookup(Function* function);
+  void emit_memo_store(Value* value);
 
   void begin_scope();
   void end_scope();
+  // a scope ended on every way out, early error returns included
+  class Scope {
+   public:
+    explicit Scope(Codegen& codegen) : codegen_{codegen} {
+      codegen_.begin_scope();
+    }
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+    ~Scope() { codegen_.end_scope(); }
 
-  AllocaInst* get_variable(const std::string& name);
-  void set_variable(const std::string& name, AllocaInst* alloca);
+   private:
+    Codegen& codegen_;
+  };
 
-  Function* get_function(const std::string& name,
+  Variable get_variable(Symbol name);
+  void set_variable(Symbol name, Variable variable);
+
+  Function* get_function(Symbol name,
                          const std::vector<Type*>& arg_types,
                          bool expect_declared);
 };
+
+OptimizationLevel get_optimization_level(OptLevel level);
@@ -0,0 +1,362 @@
+#include <pthread.h>
+
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "analysis.h"
+#include "constfold.h"
+#include "interpreter.h"
+
+namespace {
+
+// thrown when an evaluation has to give up
+struct NotConstant {};
+
+// left on the stack below the deepest call evaluated, for the nesting of
+// one function body and for unwinding once evaluation gives up
+constexpr size_t stack_reserve = 256 << 10;
+
+// the lowest frame address the calling thread may evaluate at, from the
+// thread's own stack so pool workers and the main thread each get theirs
+const char* stack_limit() {
+  const char* frame = static_cast<const char*>(__builtin_frame_address(0));
+  pthread_attr_t attr;
+  void* low = nullptr;
+  size_t size = 0;
+  if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+    pthread_attr_getstack(&attr, &low, &size);
+    pthread_attr_destroy(&attr);
+  }
+  // unknown, assume a megabyte left below us
+  if (!low) return frame - (1 << 20) + stack_reserve;
+  return static_cast<const char*>(low) + stack_reserve;
+}
+
+// a call with constant arguments, as the evaluator remembers it
+struct ConstantCall {
+  Symbol callee;
+  std::vector<int> args;
+  bool operator==(const ConstantCall& other) const = default;
+};
+
+struct ConstantCallHash {
+  size_t operator()(const ConstantCall& call) const {
+    size_t hash = std::hash<Symbol>{}(call.callee);
+    for (int arg : call.args) {
+      hash = hash * 31 + std::hash<int>{}(arg);
+    }
+    return hash;
+  }
+};
+
+// Evaluates calls to pure functions on constant arguments, within one step
+// budget shared by every call and the stack of the thread it was made on.
+// Each call's outcome is remembered, so a repeated one costs no steps.
+class Evaluator : public ASTVisitor<Evaluator, int> {
+ public:
+  Evaluator(const std::unordered_map<Symbol, FunctionAST*>& functions,
+            const std::unordered_set<Symbol>& pure, uint64_t step_budget)
+      : functions_{functions},
+        pure_{pure},
+        stack_limit_{stack_limit()},
+        steps_{step_budget} {}
+
+  // the result, or nothing if the call could not be evaluated
+  std::pair<bool, int> evaluate(Symbol callee, std::span<const int> args) {
+    ConstantCall key{callee, {args.begin(), args.end()}};
+    if (auto cached = results_.find(key); cached != results_.end())
+      return cached->second;
+    std::pair<bool, int> result{false, 0};
+    locals_.clear();
+    frame_ = 0;
+    try {
+      result = {true, call(callee, args)};
+    } catch (const NotConstant&) {
+      // remembered too, giving up costs the budget once
+    }
+    results_.emplace(std::move(key), result);
+    return result;
+  }
+
+  int visitLiteralNode(LiteralExprAST* node) {
+    step();
+    return node->value();
+  }
+
+  int visitVariableNode(VariableExprAST* node) {
+    step();
+    return get_variable(node->name());
+  }
+
+  int visitPrefixNode(PrefixExprAST* node) {
+    step();
+    return apply_prefix(node->op(), visitNode(node->operand()));
+  }
+
+  int visitBinaryNode(BinaryExprAST* node) {
+    step();
+    if (node->op() == Token::Kind::Equals) {
+      if (node->lhs()->kind() != ExprKind::Variable) throw NotConstant{};
+      Symbol name = static_cast<VariableExprAST*>(node->lhs())->name();
+      get_variable(name);
+      int value = visitNode(node->rhs());
+      return get_variable(name) = value;
+    }
+    int lhs = visitNode(node->lhs());
+    if (node->op() == Token::Kind::And && lhs == 0) return 0;
+    if (node->op() == Token::Kind::Or && lhs != 0) return 1;
+    int rhs = visitNode(node->rhs());
+    // left for the program to report when it runs
+    if ((node->op() == Token::Kind::Slash ||
+         node->op() == Token::Kind::Remainder) &&
+        rhs == 0)
+      throw NotConstant{};
+    return apply_binary(node->op(), lhs, rhs);
+  }
+
+  int visitBlockNode(BlockExprAST* node) {
+    step();
+    if (node->exprs().empty()) throw NotConstant{};
+    int last_value = 0;
+    for (ExprAST* expr : node->exprs()) {
+      last_value = visitNode(expr);
+    }
+    return last_value;
+  }
+
+  int visitCallNode(CallExprAST* node) {
+    step();
+    std::vector<int> args;
+    args.reserve(node->args().size());
+    for (ExprAST* arg : node->args()) {
+      args.push_back(visitNode(arg));
+    }
+    return call(node->callee(), args);
+  }
+
+  int visitPrototypeNode(PrototypeAST*) { throw NotConstant{}; }
+  int visitFunctionNode(FunctionAST*) { throw NotConstant{}; }
+  // memory is left to the program
+  int visitArrayNode(ArrayExprAST*) { throw NotConstant{}; }
+  int visitIndexNode(IndexExprAST*) { throw NotConstant{}; }
+
+  int visitLetNode(LetExprAST* node) {
+    step();
+    int value = visitNode(node->expr());
+    locals_.emplace_back(node->name(), value);
+    return value;
+  }
+
+  int visitIfNode(IfExprAST* node) {
+    step();
+    int cond = visitNode(node->condition());
+    size_t scope = locals_.size();
+    int value = 0;
+    if (cond != 0) {
+      value = visitNode(node->then_expr());
+    } else if (node->else_expr()) {
+      value = visitNode(node->else_expr());
+    }
+    locals_.resize(scope);
+    return value;
+  }
+
+  int visitLoopNode(LoopExprAST* node) {
+    step();
+    size_t scope = locals_.size();
+    if (node->init()) visitNode(node->init());
+    size_t body_scope = locals_.size();
+    while (!node->condition() || visitNode(node->condition()) != 0) {
+      step();
+      if (!is_empty_block(node->body())) visitNode(node->body());
+      locals_.resize(body_scope);
+      if (node->step()) visitNode(node->step());
+    }
+    locals_.resize(scope);
+    return 0;
+  }
+
+ private:
+  const std::unordered_map<Symbol, FunctionAST*>& functions_;
+  const std::unordered_set<Symbol>& pure_;
+  const char* stack_limit_;
+  std::vector<std::pair<Symbol, int>> locals_;
+  size_t frame_ = 0;
+  // what is left of the budget for the whole compile
+  uint64_t steps_;
+  std::unordered_map<ConstantCall, std::pair<bool, int>, ConstantCallHash>
+      results_;
+
+  void step() {
+    if (steps_ == 0) throw NotConstant{};
+    --steps_;
+  }
+
+  int call(Symbol callee, std::span<const int> args) {
+    // recursion ends where the stack does, however much each call takes
+    if (!pure_.contains(callee) ||
+        __builtin_frame_address(0) < stack_limit_)
+      throw NotConstant{};
+    FunctionAST* function = functions_.at(callee);
+    auto params = function->prototype()->args();
+    if (params.size() != args.size()) throw NotConstant{};
+    size_t caller_frame = frame_;
+    frame_ = locals_.size();
+    for (size_t i = 0; i < args.size(); ++i) {
+      locals_.emplace_back(params[i], args[i]);
+    }
+    int result = visitNode(function->body());
+    locals_.resize(frame_);
+    frame_ = caller_frame;
+    return result;
+  }
+
+  int& get_variable(Symbol name) {
+    for (size_t i = locals_.size(); i > frame_; --i) {
+      if (locals_[i - 1].first == name) return locals_[i - 1].second;
+    }
+    throw NotConstant{};
+  }
+};
+
+// Folds bottom up, returning the node that replaces each visited one.
+class ConstantFolder : public ASTVisitor<ConstantFolder, ExprAST*> {
+ public:
+  ConstantFolder(ASTContext& context, Evaluator* evaluator)
+      : context_{context}, evaluator_{evaluator} {}
+
+  ExprAST* visitLiteralNode(LiteralExprAST* node) { return node; }
+  ExprAST* visitVariableNode(VariableExprAST* node) { return node; }
+
+  ExprAST* visitPrefixNode(PrefixExprAST* node) {
+    node->operand() = visitNode(node->operand());
+    if (auto operand = literal(node->operand()))
+      return make_literal(apply_prefix(node->op(), *operand));
+    return node;
+  }
+
+  ExprAST* visitBinaryNode(BinaryExprAST* node) {
+    node->lhs() = visitNode(node->lhs());
+    node->rhs() = visitNode(node->rhs());
+    auto lhs = literal(node->lhs()), rhs = literal(node->rhs());
+    // a constant lhs that decides && or || drops the rhs unevaluated
+    if (lhs && node->op() == Token::Kind::And && *lhs == 0)
+      return make_literal(0);
+    if (lhs && node->op() == Token::Kind::Or && *lhs != 0)
+      return make_literal(1);
+    if (!lhs || !rhs || node->op() == Token::Kind::Equals) return node;
+    if ((node->op() == Token::Kind::Slash ||
+         node->op() == Token::Kind::Remainder) &&
+        *rhs == 0)
+      return node;
+    return make_literal(apply_binary(node->op(), *lhs, *rhs));
+  }
+
+  ExprAST* visitBlockNode(BlockExprAST* node) {
+    for (ExprAST*& expr : node->exprs()) {
+      expr = visitNode(expr);
+    }
+    return node;
+  }
+
+  ExprAST* visitCallNode(CallExprAST* node) {
+    std::vector<int> args;
+    for (ExprAST*& arg : node->args()) {
+      arg = visitNode(arg);
+      if (auto value = literal(arg)) args.push_back(*value);
+    }
+    if (!evaluator_ || args.size() != node->args().size()) return node;
+    auto [constant, value] = evaluator_->evaluate(node->callee(), args);
+    return constant ? make_literal(value) : node;
+  }
+
+  ExprAST* visitPrototypeNode(PrototypeAST* node) { return node; }
+
+  ExprAST* visitFunctionNode(FunctionAST* node) {
+    node->body() = visitNode(node->body());
+    return node;
+  }
+
+  ExprAST* visitLetNode(LetExprAST* node) {
+    node->expr() = visitNode(node->expr());
+    return node;
+  }
+
+  ExprAST* visitIfNode(IfExprAST* node) {
+    node->condition() = visitNode(node->condition());
+    node->then_expr() = visitNode(node->then_expr());
+    if (node->else_expr()) node->else_expr() = visitNode(node->else_expr());
+    auto cond = literal(node->condition());
+    if (!cond) return node;
+    ExprAST* taken = *cond != 0 ? node->then_expr() : node->else_expr();
+    if (!taken) return make_literal(0);
+    // a branch is a scope, a block in its place would leak its lets
+    if (auto value = literal(taken)) return make_literal(*value);
+    if (taken->kind() == ExprKind::Block) {
+      for (ExprAST* expr : static_cast<BlockExprAST*>(taken)->exprs()) {
+        if (expr->kind() == ExprKind::Let) return node;
+      }
+    }
+    return taken;
+  }
+
+  ExprAST* visitLoopNode(LoopExprAST* node) {
+    if (node->init()) node->init() = visitNode(node->init());
+    if (node->condition()) node->condition() = visitNode(node->condition());
+    if (node->step()) node->step() = visitNode(node->step());
+    node->body() = visitNode(node->body());
+    auto cond = node->condition() ? literal(node->condition()) : std::nullopt;
+    // a loop that never runs does nothing, unless its init does
+    if (cond && *cond == 0 && !node->init()) return make_literal(0);
+    return node;
+  }
+
+  ExprAST* visitArrayNode(ArrayExprAST* node) { return node; }
+
+  ExprAST* visitIndexNode(IndexExprAST* node) {
+    node->index() = visitNode(node->index());
+    return node;
+  }
+
+ private:
+  ASTContext& context_;
+  // null when call evaluation is disabled
+  Evaluator* evaluator_;
+
+  // the value of node if it is a literal, or a block that is one
+  static std::optional<int> literal(ExprAST* node) {
+    while (node->kind() == ExprKind::Block) {
+      auto exprs = static_cast<BlockExprAST*>(node)->exprs();
+      if (exprs.size() != 1) return std::nullopt;
+      node = exprs[0];
+    }
+    if (node->kind() != ExprKind::Literal) return std::nullopt;
+    return static_cast<LiteralExprAST*>(node)->value();
+  }
+
+  ExprAST* make_literal(int value) {
+    return context_.make<LiteralExprAST>(value);
+  }
+};
+
+}  // namespace
+
+void fold_constants(std::span<ExprAST* const> items, ASTContext& context,
+                    uint64_t step_budget) {
+  std::unordered_map<Symbol, FunctionAST*> functions;
+  for (ExprAST* item : items) {
+    if (item->kind() != ExprKind::Function) continue;
+    auto function = static_cast<FunctionAST*>(item);
+    functions.try_emplace(function->prototype()->name(), function);
+  }
+  // the only side effects the language has are extern calls
+  std::unordered_set<Symbol> pure = analyze_functions(items).pure;
+  Evaluator evaluator{functions, pure, step_budget};
+  ConstantFolder folder{context, step_budget != 0 ? &evaluator : nullptr};
+  for (ExprAST* item : items) {
+    folder.visitNode(item);
+  }
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+#include "ast.h"
+#include "astcontext.h"
+
+// Rewrites function bodies between parsing and codegen. Prefix, binary and
+// if expressions over literals are folded, and calls with constant
+// arguments to pure functions, which reach no extern, are evaluated and
+// replaced by their result. All calls together may take at most
+// step_budget steps, 0 disables call evaluation. New nodes are allocated in
+// context.
+void fold_constants(std::span<ExprAST* const> items, ASTContext& context,
+                    uint64_t step_budget);
@@ -0,0 +1,150 @@
+#include <spawn.h>
+#include <sys/wait.h>
+
+#include <cctype>
+#include <cstring>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetOptions.h>
+#include <llvm/TargetParser/Host.h>
+
+#include "emitter.h"
+#include "timereport.h"
+#include "fmt.h"
+
+extern char** environ;
+
+CodeGenOptLevel get_codegen_opt_level(OptLevel level) {
+  switch (level) {
+    case OptLevel::O0:
+      return CodeGenOptLevel::None;
+    case OptLevel::O1:
+      return CodeGenOptLevel::Less;
+    case OptLevel::O2:
+    case OptLevel::Os:
+      return CodeGenOptLevel::Default;
+    case OptLevel::O3:
+      return CodeGenOptLevel::Aggressive;
+  }
+  error("invalid optimization level");
+}
+
+std::mutex target_setup_mutex;
+
+Emitter::Emitter(OptLevel level) {
+  std::lock_guard lock{target_setup_mutex};
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
+  std::string triple = sys::getDefaultTargetTriple();
+  std::string error_message;
+  const Target* target = TargetRegistry::lookupTarget(triple, error_message);
+  if (!target) error("%s", error_message.c_str());
+  TargetOptions options;
+  target_machine_.reset(target->createTargetMachine(
+      triple, sys::getHostCPUName(), "", options, Reloc::PIC_, std::nullopt,
+      get_codegen_opt_level(level)));
+  if (!target_machine_)
+    error("could not create target machine, %s", triple.c_str());
+}
+
+TargetMachine& Emitter::target_machine() {
+  return *target_machine_;
+}
+
+void Emitter::emit(Module& module, EmitKind kind,
+                   const std::string& file_name) {
+  std::error_code ec;
+  raw_fd_ostream os{file_name, ec,
+                    kind == EmitKind::IR || kind == EmitKind::Assembly
+                        ? sys::fs::OF_Text
+                        : sys::fs::OF_None};
+  if (ec)
+    error("could not open %s, %s", file_name.c_str(), ec.message().c_str());
+  emit(module, kind, os);
+}
+
+void Emitter::emit(Module& module, EmitKind kind, raw_pwrite_stream& os) {
+  TimeScope timing{"emit"};
+  switch (kind) {
+    case EmitKind::Bitcode:
+      WriteBitcodeToFile(module, os);
+      return;
+    case EmitKind::IR:
+      module.print(os, nullptr);
+      return;
+    case EmitKind::Object:
+    case EmitKind::Assembly: {
+      legacy::PassManager pass_manager;
+      if (target_machine_->addPassesToEmitFile(
+              pass_manager, os, nullptr,
+              kind == EmitKind::Object ? CodeGenFileType::ObjectFile
+                                       : CodeGenFileType::AssemblyFile))
+        error("target cannot emit this file type");
+      pass_manager.run(module);
+      return;
+    }
+    case EmitKind::Executable:
+      break;
+  }
+  error("executables are linked, not emitted");
+}
+
+// an argument in a response file, where whitespace separates them
+static std::string response_file_argument(std::string_view arg) {
+  std::string escaped;
+  for (char c : arg) {
+    if (isspace(static_cast<unsigned char>(c)) || c == '\\' || c == '\'' ||
+        c == '"')
+      escaped += '\\';
+    escaped += c;
+  }
+  return escaped;
+}
+
+void link_executable(const std::vector<std::string>& objects,
+                     const std::string& output_file) {
+  TimeScope timing{"link"};
+  // a program cached function by function has more objects than fit on a
+  // command line
+  SmallString<128> response_file;
+  int fd;
+  if (std::error_code ec = sys::fs::createTemporaryFile("cata-link", "rsp",
+                                                        fd, response_file))
+    error("could not create a temporary file, %s", ec.message().c_str());
+  {
+    raw_fd_ostream os{fd, /*shouldClose=*/true};
+    for (const std::string& object : objects) {
+      os << response_file_argument(object) << '\n';
+    }
+    // built once with cata, see CMakeLists.txt
+    os << response_file_argument(CATA_RUNTIME_LIBRARY) << '\n';
+    os.close();
+    if (os.has_error()) {
+      sys::fs::remove(response_file);
+      error("could not write %s, %s", response_file.c_str(),
+            os.error().message().c_str());
+    }
+  }
+  std::vector<std::string> args{"cc", "-o", output_file,
+                                "@" + std::string{response_file}};
+  std::vector<char*> argv;
+  for (std::string& arg : args) argv.push_back(arg.data());
+  argv.push_back(nullptr);
+  pid_t pid;
+  if (int failure = posix_spawnp(&pid, argv[0], nullptr, nullptr,
+                                 argv.data(), environ)) {
+    sys::fs::remove(response_file);
+    error("could not run the linker, %s, %s", argv[0], strerror(failure));
+  }
+  int status;
+  bool linked = waitpid(pid, &status, 0) >= 0 && WIFEXITED(status) &&
+                WEXITSTATUS(status) == 0;
+  sys::fs::remove(response_file);
+  if (!linked) error("linking %s failed", output_file.c_str());
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+
+#include "options.h"
+
+using namespace llvm;
+
+// Registering targets and creating target machines is not thread safe in
+// LLVM; Emitter and JIT hold this while they do.
+extern std::mutex target_setup_mutex;
+
+// Lowers modules to machine code for the host, in process. Emitters can be
+// made on any thread, but each is used by one thread at a time.
+class Emitter {
+ public:
+  Emitter(OptLevel level);
+
+  TargetMachine& target_machine();
+
+  // writes module as kind, which must not be EmitKind::Executable
+  void emit(Module& module, EmitKind kind, const std::string& file_name);
+  void emit(Module& module, EmitKind kind, raw_pwrite_stream& os);
+
+ private:
+  std::unique_ptr<TargetMachine> target_machine_;
+};
+
+CodeGenOptLevel get_codegen_opt_level(OptLevel level);
+
+// Links objects and the prebuilt runtime into an executable, with a single
+// linker invocation that reads them from a response file.
+void link_executable(const std::vector<std::string>& objects,
+                     const std::string& output_file);
@@ -0,0 +1,212 @@
+#include <llvm/IR/IRBuilder.h>
+
+#include "codegen.h"
+#include "engine.h"
+#include "runtime.h"
+#include "fmt.h"
+
+// interpreted calls before a function is compiled
+constexpr uint32_t baseline_threshold = 100;
+
+// entry from compiled code back into the engine, see define_bridge
+static int interpreter_call(Engine* engine, FunctionInfo* function,
+                            const int* args) {
+  return engine->call(*function,
+                      {args, function->prototype->args().size()});
+}
+
+Engine::Engine(std::span<ExprAST* const> items, SymbolTable& symbols,
+               Codegen& codegen, OptLevel level, bool tiered)
+    : symbols_{symbols}, codegen_{codegen}, interpreter_{*this} {
+  for (ExprAST* item : items) {
+    FunctionAST* definition = nullptr;
+    PrototypeAST* prototype;
+    if (item->kind() == ExprKind::Function) {
+      definition = static_cast<FunctionAST*>(item);
+      prototype = definition->prototype();
+    } else if (item->kind() == ExprKind::Array) {
+      error("array %s needs compiled code, run with --engine=jit",
+            static_cast<ArrayExprAST*>(item)->name().str().c_str());
+    } else {
+      prototype = static_cast<PrototypeAST*>(item);
+    }
+    FunctionInfo& function = functions_[prototype->name()];
+    if (function.prototype &&
+        function.prototype->args().size() != prototype->args().size())
+      error("function %s expects %lu arguments, but got %lu",
+            prototype->name().str().c_str(),
+            function.prototype->args().size(), prototype->args().size());
+    if (definition) {
+      if (function.definition)
+        error("redefinition of function, %s",
+              prototype->name().str().c_str());
+      function.definition = definition;
+    }
+    if (!function.prototype) function.prototype = prototype;
+    codegen_.declare(prototype);
+  }
+  for (const RuntimeFunction& runtime : runtime_functions) {
+    auto it = functions_.find(symbols_.find(runtime.name));
+    if (it != functions_.end() && !it->second.definition)
+      it->second.code = runtime.address;
+  }
+  if (!tiered) return;
+  baseline_ = std::make_unique<JIT>(OptLevel::O0);
+  codegen_.set_opt_level(OptLevel::O0, &baseline_->target_machine());
+  if (level == OptLevel::O0) return;
+  optimizing_ = std::make_unique<JIT>(level);
+  optimizer_ = std::thread{&Engine::optimize_in_background, this};
+}
+
+Engine::~Engine() {
+  if (!optimizer_.joinable()) return;
+  {
+    std::lock_guard lock{mutex_};
+    stopping_ = true;
+  }
+  jobs_ready_.notify_one();
+  optimizer_.join();
+}
+
+int Engine::run_main() {
+  Symbol main = symbols_.find("main");
+  if (!main) error("called undefined function, main");
+  return call(function(main), {});
+}
+
+FunctionInfo& Engine::function(Symbol name) {
+  auto it = functions_.find(name);
+  if (it == functions_.end())
+    error("called undefined function, %s", name.str().c_str());
+  return it->second;
+}
+
+int Engine::call(FunctionInfo& function, std::span<const int> args) {
+  if (function.prototype->args().size() != args.size())
+    error("function %s expects %lu arguments, but got %lu",
+          function.prototype->name().str().c_str(),
+          function.prototype->args().size(), args.size());
+  if (void* code = function.code.load(std::memory_order_acquire))
+    return call_native(code, args);
+  if (!function.definition)
+    error("called undefined function, %s",
+          function.prototype->name().str().c_str());
+  ++function.calls;
+  if (is_hot(function)) {
+    compile(function);
+    return call_native(function.code.load(std::memory_order_acquire), args);
+  }
+  return interpreter_.call(function, args);
+}
+
+bool Engine::is_hot(const FunctionInfo& function) const {
+  return baseline_ &&
+         function.prototype->args().size() <= max_native_args &&
+         uint64_t{function.calls} + function.back_edges >= baseline_threshold;
+}
+
+void Engine::compile(FunctionInfo& function) {
+  std::string name = function.prototype->name().str();
+  auto [context, module] = generate(function, true);
+  function.code.store(
+      baseline_->compile(std::move(context), std::move(module), name),
+      std::memory_order_release);
+  if (!optimizing_) return;
+  // codegen is single threaded, so the optimizer gets its own copy of the
+  // IR, in its own context
+  auto [optimize_context, optimize_module] = generate(function, false);
+  OptimizeJob job{&function, std::move(optimize_context),
+                  std::move(optimize_module)};
+  {
+    std::lock_guard lock{mutex_};
+    jobs_.push_back(std::move(job));
+  }
+  jobs_ready_.notify_one();
+}
+
+std::pair<std::unique_ptr<LLVMContext>, std::unique_ptr<Module>>
+Engine::generate(FunctionInfo& function, bool baseline) {
+  auto compiled = static_cast<Function*>(
+      codegen_.visitNode(function.definition));
+  if (!compiled)
+    error("failed to compile function, %s",
+          function.prototype->name().str().c_str());
+  auto [context, module] = codegen_.take_module();
+  if (baseline) {
+    Function* self = Function::Create(compiled->getFunctionType(),
+                                      GlobalValue::InternalLinkage,
+                                      compiled->getName() + ".self", *module);
+    compiled->replaceAllUsesWith(self);
+    define_bridge(*self, function);
+  }
+  for (Function& callee : *module) {
+    if (!callee.isDeclaration()) continue;
+    auto it = functions_.find(symbols_.find(callee.getName()));
+    // the runtime is linked directly
+    if (it == functions_.end() || (it->second.code && !it->second.definition))
+      continue;
+    define_bridge(callee, it->second);
+  }
+  return {std::move(context), std::move(module)};
+}
+
+void Engine::define_bridge(Function& callee, FunctionInfo& target) {
+  LLVMContext& context = callee.getContext();
+  callee.setLinkage(GlobalValue::InternalLinkage);
+  BasicBlock* entry = BasicBlock::Create(context, "entry", &callee);
+  BasicBlock* compiled = BasicBlock::Create(context, "compiled", &callee);
+  BasicBlock* interpreted = BasicBlock::Create(context, "interpreted", &callee);
+  IRBuilder<> builder{entry};
+  PointerType* pointer_type = PointerType::getUnqual(context);
+  // everything lives in this process, so addresses are constants
+  auto address = [&](const void* pointer) {
+    return builder.CreateIntToPtr(
+        builder.getInt64(reinterpret_cast<uintptr_t>(pointer)), pointer_type);
+  };
+  std::vector<Value*> args;
+  for (Argument& arg : callee.args()) {
+    args.push_back(&arg);
+  }
+  AllocaInst* frame = builder.CreateAlloca(
+      ArrayType::get(builder.getInt32Ty(), args.size()), nullptr, "args");
+  LoadInst* code = builder.CreateAlignedLoad(
+      pointer_type, address(&target.code), Align(alignof(void*)), "code");
+  code->setAtomic(AtomicOrdering::Acquire);
+  builder.CreateCondBr(builder.CreateIsNotNull(code), compiled, interpreted);
+
+  builder.SetInsertPoint(compiled);
+  builder.CreateRet(builder.CreateCall(callee.getFunctionType(), code, args));
+
+  builder.SetInsertPoint(interpreted);
+  for (size_t i = 0; i < args.size(); ++i) {
+    builder.CreateStore(args[i], builder.CreateConstInBoundsGEP2_32(
+                                     frame->getAllocatedType(), frame, 0, i));
+  }
+  FunctionType* interpreter_call_type = FunctionType::get(
+      builder.getInt32Ty(), {pointer_type, pointer_type, pointer_type}, false);
+  builder.CreateRet(builder.CreateCall(
+      interpreter_call_type,
+      address(reinterpret_cast<const void*>(&interpreter_call)),
+      {address(this), address(&target), frame}));
+}
+
+void Engine::optimize_in_background() {
+  std::unique_lock lock{mutex_};
+  while (true) {
+    jobs_ready_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+    if (stopping_) return;
+    OptimizeJob job = std::move(jobs_.front());
+    jobs_.pop_front();
+    lock.unlock();
+    try {
+      void* code = optimizing_->compile(
+          std::move(job.context), std::move(job.module),
+          job.function->prototype->name().str());
+      job.function->code.store(code, std::memory_order_release);
+    } catch (const std::exception& e) {
+      // the baseline code keeps running
+      log("optimizing failed, %s", e.what());
+    }
+    lock.lock();
+  }
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <unordered_map>
+
+#include <llvm/IR/Function.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+
+#include "ast.h"
+#include "codegen.h"
+#include "interpreter.h"
+#include "jit.h"
+#include "options.h"
+
+using namespace llvm;
+
+// A function the program can call, in whichever tier it has reached.
+struct FunctionInfo {
+  PrototypeAST* prototype = nullptr;
+  // null for functions only declared extern
+  FunctionAST* definition = nullptr;
+  // compiled code once a tier has produced it, swapped for the optimized
+  // version by the background thread; compiled callers load it too
+  std::atomic<void*> code{nullptr};
+  // bumped while interpreted, on calls and on loop back-edges
+  uint32_t calls = 0;
+  uint32_t back_edges = 0;
+};
+
+// Tiered execution. Every function starts in the interpreter; once it is
+// hot it is compiled at -O0 on the spot, and recompiled at the selected
+// level on a background thread whose result replaces the baseline code.
+class Engine {
+ public:
+  // without tiering, everything is interpreted; symbols are those items
+  // were parsed with; codegen generates the compiled tiers, the engine
+  // resets its level
+  Engine(std::span<ExprAST* const> items, SymbolTable& symbols,
+         Codegen& codegen, OptLevel level, bool tiered);
+  ~Engine();
+
+  Engine(const Engine&) = delete;
+  Engine& operator=(const Engine&) = delete;
+
+  int run_main();
+
+  FunctionInfo& function(Symbol name);
+  int call(FunctionInfo& function, std::span<const int> args);
+
+ private:
+  struct OptimizeJob {
+    FunctionInfo* function;
+    std::unique_ptr<LLVMContext> context;
+    std::unique_ptr<Module> module;
+  };
+
+  std::unordered_map<Symbol, FunctionInfo> functions_;
+  SymbolTable& symbols_;
+  Codegen& codegen_;
+  Interpreter interpreter_;
+  std::unique_ptr<JIT> baseline_;
+  // null at -O0, where the baseline is final
+  std::unique_ptr<JIT> optimizing_;
+
+  std::mutex mutex_;
+  std::condition_variable jobs_ready_;
+  std::deque<OptimizeJob> jobs_;
+  bool stopping_ = false;
+  std::thread optimizer_;
+
+  bool is_hot(const FunctionInfo& function) const;
+  void compile(FunctionInfo& function);
+  // IR for one function; baseline code makes even recursive calls through
+  // the bridge, so deep recursion moves over to the optimized code
+  std::pair<std::unique_ptr<LLVMContext>, std::unique_ptr<Module>> generate(
+      FunctionInfo& function, bool baseline);
+  // gives a callee declared in a generated module a body that calls the
+  // target's current code, or the interpreter while it has none
+  void define_bridge(Function& callee, FunctionInfo& target);
+  void optimize_in_background();
+};
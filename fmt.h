@@ -1,17 +1,29 @@
 #pragma once
 
+#include <cstdio>
+#include <stdexcept>
+
 // #define NDEBUG
 
+// log() prints to stderr once main sets this for --log; NDEBUG compiles it
+// out
+inline bool log_enabled = false;
+
 #ifdef NDEBUG
 #define log(fmt, ...)
 #else
-#define log(fmt, ...)                                                 \
-  printf("[%s at %s:%d] " fmt "\n", __FUNCTION__, __FILE__, __LINE__, \
-         ##__VA_ARGS__)
+#define log(fmt, ...)                                                      \
+  do {                                                                     \
+    if (log_enabled)                                                       \
+      fprintf(stderr, "[%s at %s:%d] " fmt "\n", __FUNCTION__, __FILE__, \
+              __LINE__, ##__VA_ARGS__);                                    \
+  } while (0)
 #endif
 
 #define error_raw(msg) throw std::runtime_error(msg)
 
+// error() would replace the error() members of LLVM classes, so fmt.h is
+// included after every header that pulls in LLVM, last of all.
 #define error(fmt, ...)                                                      \
   do {                                                                       \
     char buf[1024];                                                          \
@@ -20,6 +32,7 @@
     throw std::runtime_error(buf);                                           \
   } while (0)
 
-#define error_expected(tokenizer, token, fmt, ...)                    \
-  error("in line %d: expected " fmt " (got %s/%s)", tokenizer.line(), \
-        ##__VA_ARGS__, token.as_string().c_str(), token.lexeme().c_str())
+#define error_expected(tokens, token, fmt, ...)                          \
+  error("in line %d: expected " fmt " (got %s/%.*s)", tokens.line(token), \
+        ##__VA_ARGS__, token.as_string().c_str(),                        \
+        (int)token.lexeme().size(), token.lexeme().data())
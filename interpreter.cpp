@@ -0,0 +1,207 @@
+#include <climits>
+#include <cstdint>
+
+#include "interpreter.h"
+#include "engine.h"
+#include "fmt.h"
+
+int apply_prefix(Token::Kind op, int operand) {
+  switch (op) {
+    case Token::Kind::Not:
+      return operand == 0;
+    case Token::Kind::Plus:
+      return operand;
+    case Token::Kind::Minus:
+      return -static_cast<unsigned>(operand);
+    case Token::Kind::Tilde:
+      return ~operand;
+    default:
+      error("invalid prefix operator, %s", Token(op).as_string().c_str());
+  }
+}
+
+// Arithmetic wraps like the generated code, which has no nsw flags.
+int apply_binary(Token::Kind op, int a, int b) {
+  unsigned lhs = a, rhs = b;
+  switch (op) {
+    case Token::Kind::Plus:
+      return lhs + rhs;
+    case Token::Kind::Minus:
+      return lhs - rhs;
+    case Token::Kind::Star:
+      return lhs * rhs;
+    case Token::Kind::Slash:
+    case Token::Kind::Remainder:
+      if (rhs == 0) error("division by zero");
+      if (static_cast<int>(lhs) == INT_MIN && static_cast<int>(rhs) == -1)
+        return op == Token::Kind::Slash ? INT_MIN : 0;
+      return op == Token::Kind::Slash
+                 ? static_cast<int>(lhs) / static_cast<int>(rhs)
+                 : static_cast<int>(lhs) % static_cast<int>(rhs);
+    // bitwise
+    case Token::Kind::Ampersand:
+      return lhs & rhs;
+    case Token::Kind::Pipe:
+      return lhs | rhs;
+    case Token::Kind::Caret:
+      return lhs ^ rhs;
+    case Token::Kind::Tilde:
+      return ~rhs;
+    // shift amounts past the width are poison in IR, use the hardware's
+    case Token::Kind::LeftShift:
+      return lhs << (rhs & 31);
+    case Token::Kind::RightShift:
+      return static_cast<int>(lhs) >> (rhs & 31);
+    // logical, callers short-circuit before evaluating b
+    case Token::Kind::And:
+      return lhs != 0 && rhs != 0;
+    case Token::Kind::Or:
+      return lhs != 0 || rhs != 0;
+    // comparison
+    case Token::Kind::Eq:
+      return lhs == rhs;
+    case Token::Kind::Ne:
+      return lhs != rhs;
+    case Token::Kind::Lt:
+      return static_cast<int>(lhs) < static_cast<int>(rhs);
+    case Token::Kind::Le:
+      return static_cast<int>(lhs) <= static_cast<int>(rhs);
+    case Token::Kind::Gt:
+      return static_cast<int>(lhs) > static_cast<int>(rhs);
+    case Token::Kind::Ge:
+      return static_cast<int>(lhs) >= static_cast<int>(rhs);
+    default:
+      error("invalid binary operator, %s", Token(op).as_string().c_str());
+  }
+}
+
+Interpreter::Interpreter(Engine& engine) : engine_{engine} {}
+
+int Interpreter::call(FunctionInfo& function, std::span<const int> args) {
+  size_t caller_frame = frame_;
+  FunctionInfo* caller = function_;
+  frame_ = locals_.size();
+  function_ = &function;
+  auto params = function.prototype->args();
+  for (size_t i = 0; i < args.size(); ++i) {
+    locals_.emplace_back(params[i], args[i]);
+  }
+  int result = visitNode(function.definition->body());
+  locals_.resize(frame_);
+  frame_ = caller_frame;
+  function_ = caller;
+  return result;
+}
+
+int Interpreter::visitLiteralNode(LiteralExprAST* node) {
+  return node->value();
+}
+
+int Interpreter::visitVariableNode(VariableExprAST* node) {
+  return get_variable(node->name());
+}
+
+int Interpreter::visitPrefixNode(PrefixExprAST* node) {
+  return apply_prefix(node->op(), visitNode(node->operand()));
+}
+
+int Interpreter::visitBinaryNode(BinaryExprAST* node) {
+  if (node->op() == Token::Kind::Equals) {
+    if (node->lhs()->kind() == ExprKind::Index) return visitNode(node->lhs());
+    if (node->lhs()->kind() != ExprKind::Variable)
+      error("left hand side of assignment must be a variable");
+    Symbol name = static_cast<VariableExprAST*>(node->lhs())->name();
+    // checked before the right hand side runs, which may grow locals_
+    get_variable(name);
+    int value = visitNode(node->rhs());
+    return get_variable(name) = value;
+  }
+  int lhs = visitNode(node->lhs());
+  // && and || short-circuit
+  if (node->op() == Token::Kind::And && lhs == 0) return 0;
+  if (node->op() == Token::Kind::Or && lhs != 0) return 1;
+  return apply_binary(node->op(), lhs, visitNode(node->rhs()));
+}
+
+int Interpreter::visitBlockNode(BlockExprAST* node) {
+  if (node->exprs().empty()) error("empty block has no value");
+  int last_value = 0;
+  for (ExprAST* expr : node->exprs()) {
+    last_value = visitNode(expr);
+  }
+  return last_value;
+}
+
+int Interpreter::visitCallNode(CallExprAST* node) {
+  FunctionInfo& callee = engine_.function(node->callee());
+  size_t base = args_.size();
+  for (ExprAST* arg : node->args()) {
+    int value = visitNode(arg);
+    args_.push_back(value);
+  }
+  int result = engine_.call(callee, std::span(args_).subspan(base));
+  args_.resize(base);
+  return result;
+}
+
+int Interpreter::visitPrototypeNode(PrototypeAST* node) {
+  error("unexpected prototype, %s", node->name().str().c_str());
+}
+
+int Interpreter::visitFunctionNode(FunctionAST* node) {
+  error("unexpected function definition, %s",
+        node->prototype()->name().str().c_str());
+}
+
+int Interpreter::visitLetNode(LetExprAST* node) {
+  int value = visitNode(node->expr());
+  locals_.emplace_back(node->name(), value);
+  return value;
+}
+
+int Interpreter::visitIfNode(IfExprAST* node) {
+  int cond = visitNode(node->condition());
+  // each branch is a scope, its lets end with it
+  size_t scope = locals_.size();
+  int value = 0;
+  if (cond != 0) {
+    value = visitNode(node->then_expr());
+  } else if (node->else_expr()) {
+    value = visitNode(node->else_expr());
+  }
+  locals_.resize(scope);
+  return value;
+}
+
+int Interpreter::visitLoopNode(LoopExprAST* node) {
+  size_t scope = locals_.size();
+  if (node->init()) visitNode(node->init());
+  size_t body_scope = locals_.size();
+  while (!node->condition() || visitNode(node->condition()) != 0) {
+    if (!is_empty_block(node->body())) visitNode(node->body());
+    locals_.resize(body_scope);
+    if (node->step()) visitNode(node->step());
+    // there is no on-stack replacement, a hot loop gets the next call
+    // compiled
+    if (function_->back_edges != UINT32_MAX) ++function_->back_edges;
+  }
+  locals_.resize(scope);
+  return 0;
+}
+
+int Interpreter::visitArrayNode(ArrayExprAST* node) {
+  error("array %s needs compiled code, run with --engine=jit",
+        node->name().str().c_str());
+}
+
+int Interpreter::visitIndexNode(IndexExprAST* node) {
+  error("array %s needs compiled code, run with --engine=jit",
+        node->array().str().c_str());
+}
+
+int& Interpreter::get_variable(Symbol name) {
+  for (size_t i = locals_.size(); i > frame_; --i) {
+    if (locals_[i - 1].first == name) return locals_[i - 1].second;
+  }
+  error("use of undeclared variable, %s", name.str().c_str());
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "ast.h"
+
+class Engine;
+struct FunctionInfo;
+
+// operator semantics shared by everything that evaluates the AST
+int apply_prefix(Token::Kind op, int operand);
+int apply_binary(Token::Kind op, int lhs, int rhs);
+
+// Runs function bodies straight from the AST, so a program starts before
+// anything is compiled. Calls go through the engine, which decides where
+// the callee runs.
+class Interpreter : ASTVisitor<Interpreter, int> {
+ public:
+  Interpreter(Engine& engine);
+
+  // runs function's definition, counting its loop iterations in it
+  int call(FunctionInfo& function, std::span<const int> args);
+
+ private:
+  friend class ASTVisitor;
+
+  Engine& engine_;
+  // variables of every active call, innermost binding last
+  std::vector<std::pair<Symbol, int>> locals_;
+  // where the running call's variables start in locals_
+  size_t frame_ = 0;
+  FunctionInfo* function_ = nullptr;
+  // arguments being evaluated, nested calls push on top
+  std::vector<int> args_;
+
+  int visitLiteralNode(LiteralExprAST* node);
+  int visitVariableNode(VariableExprAST* node);
+  int visitPrefixNode(PrefixExprAST* node);
+  int visitBinaryNode(BinaryExprAST* node);
+  int visitBlockNode(BlockExprAST* node);
+  int visitCallNode(CallExprAST* node);
+  int visitPrototypeNode(PrototypeAST* node);
+  int visitFunctionNode(FunctionAST* node);
+  int visitLetNode(LetExprAST* node);
+  int visitIfNode(IfExprAST* node);
+  int visitLoopNode(LoopExprAST* node);
+  int visitArrayNode(ArrayExprAST* node);
+  int visitIndexNode(IndexExprAST* node);
+
+  int& get_variable(Symbol name);
+};
@@ -1 +1 @@
-rm program.exe program.s
+rm -f program program.o program.ll program.s
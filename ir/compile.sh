@@ -1 +0,0 @@
-llc program.ll && cc program.s lib.c -o program
@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 int input() {
   int a;
@@ -10,3 +12,90 @@ int print(int a) {
   printf("%d\n", a);
   return 0;
 }
+
+// Memo tables of @memo functions, one per function, keyed on all of its
+// arguments. Open addressing with linear probing, grown at half full.
+struct cata_memo {
+  int nargs;
+  unsigned mask;
+  unsigned count;
+  unsigned char* used;
+  // nargs keys then the value, per slot
+  int* slots;
+};
+
+static unsigned cata_memo_hash(const int* keys, int nargs) {
+  unsigned hash = 2166136261u;
+  for (int i = 0; i < nargs; ++i) {
+    hash = (hash ^ (unsigned)keys[i]) * 16777619u;
+  }
+  return hash ^ (hash >> 15);
+}
+
+static int* cata_memo_find(struct cata_memo* table, const int* keys) {
+  unsigned index = cata_memo_hash(keys, table->nargs) & table->mask;
+  for (;; index = (index + 1) & table->mask) {
+    int* slot = table->slots + (size_t)index * (table->nargs + 1);
+    if (!table->used[index]) return slot;
+    if (!memcmp(slot, keys, sizeof(int) * table->nargs)) return slot;
+  }
+}
+
+static struct cata_memo* cata_memo_create(int nargs, unsigned capacity) {
+  struct cata_memo* table = malloc(sizeof(struct cata_memo));
+  if (!table) abort();
+  table->nargs = nargs;
+  table->mask = capacity - 1;
+  table->count = 0;
+  table->used = calloc(capacity, 1);
+  table->slots = malloc(sizeof(int) * (nargs + 1) * (size_t)capacity);
+  if (!table->used || !table->slots) abort();
+  return table;
+}
+
+int cata_memo_lookup(struct cata_memo** table, const int* keys, int nargs,
+                     int* value) {
+  if (!*table) return 0;
+  int* slot = cata_memo_find(*table, keys);
+  size_t index = (slot - (*table)->slots) / (nargs + 1);
+  if (!(*table)->used[index]) return 0;
+  *value = slot[nargs];
+  return 1;
+}
+
+void cata_memo_store(struct cata_memo** table, const int* keys, int nargs,
+                     int value) {
+  if (!*table) *table = cata_memo_create(nargs, 64);
+  struct cata_memo* old = *table;
+  if (2 * (old->count + 1) > old->mask + 1) {
+    struct cata_memo* grown = cata_memo_create(nargs, 2 * (old->mask + 1));
+    for (unsigned i = 0; i <= old->mask; ++i) {
+      if (!old->used[i]) continue;
+      int* from = old->slots + (size_t)i * (nargs + 1);
+      int* to = cata_memo_find(grown, from);
+      memcpy(to, from, sizeof(int) * (nargs + 1));
+      grown->used[(to - grown->slots) / (nargs + 1)] = 1;
+      ++grown->count;
+    }
+    free(old->used);
+    free(old->slots);
+    free(old);
+    *table = grown;
+  }
+  int* slot = cata_memo_find(*table, keys);
+  size_t index = (slot - (*table)->slots) / (nargs + 1);
+  if (!(*table)->used[index]) {
+    (*table)->used[index] = 1;
+    ++(*table)->count;
+    memcpy(slot, keys, sizeof(int) * nargs);
+  }
+  slot[nargs] = value;
+}
+
+// Array indices the compiler could not prove in bounds are checked before
+// the access, and end the program here when they are not.
+void cata_bounds_fail(int index, int size) {
+  fprintf(stderr, "error: index %d out of bounds of array of %d elements\n",
+          index, size);
+  exit(1);
+}
@@ -0,0 +1,104 @@
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/ExecutionEngine/Orc/Mangling.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/TargetSelect.h>
+
+#include "codegen.h"
+#include "emitter.h"
+#include "jit.h"
+#include "runtime.h"
+#include "fmt.h"
+
+template <typename T>
+static T unwrap(Expected<T> value) {
+  if (!value) error("%s", toString(value.takeError()).c_str());
+  return std::move(*value);
+}
+
+static void check(Error err) {
+  if (err) error("%s", toString(std::move(err)).c_str());
+}
+
+JIT::JIT(OptLevel level) : opt_level_{level} {
+  std::unique_lock lock{target_setup_mutex};
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
+  auto builder = unwrap(orc::JITTargetMachineBuilder::detectHost());
+  builder.setCodeGenOptLevel(get_codegen_opt_level(level));
+  target_machine_ = unwrap(builder.createTargetMachine());
+  jit_ = unwrap(orc::LLLazyJITBuilder()
+                    .setJITTargetMachineBuilder(std::move(builder))
+                    .create());
+  lock.unlock();
+  // one partition per function, compiled when it is first called
+  jit_->setPartitionFunction(orc::CompileOnDemandLayer::compileRequested);
+  jit_->getIRTransformLayer().setTransform(
+      [this](orc::ThreadSafeModule module,
+             const orc::MaterializationResponsibility&) {
+        module.withModuleDo([this](Module& m) { optimize(m); });
+        return Expected<orc::ThreadSafeModule>(std::move(module));
+      });
+  define_runtime_symbols();
+}
+
+TargetMachine& JIT::target_machine() {
+  return *target_machine_;
+}
+
+void JIT::add_module(std::unique_ptr<LLVMContext> context,
+                     std::unique_ptr<Module> module) {
+  module->setDataLayout(jit_->getDataLayout());
+  check(jit_->addLazyIRModule(
+      orc::ThreadSafeModule(std::move(module), std::move(context))));
+}
+
+void* JIT::compile(std::unique_ptr<LLVMContext> context,
+                   std::unique_ptr<Module> module, const std::string& name) {
+  module->setDataLayout(jit_->getDataLayout());
+  check(jit_->addIRModule(
+      orc::ThreadSafeModule(std::move(module), std::move(context))));
+  return unwrap(jit_->lookup(name)).toPtr<void*>();
+}
+
+int JIT::run_main() {
+  auto main = unwrap(jit_->lookup("main")).toPtr<int (*)()>();
+  return main();
+}
+
+void JIT::define_runtime_symbols() {
+  orc::MangleAndInterner mangle{jit_->getExecutionSession(),
+                                jit_->getDataLayout()};
+  JITSymbolFlags flags = JITSymbolFlags::Exported | JITSymbolFlags::Callable;
+  orc::SymbolMap symbols;
+  for (const RuntimeFunction& runtime : runtime_functions) {
+    symbols[mangle(runtime.name)] = {
+        orc::ExecutorAddr::fromPtr(runtime.address), flags};
+  }
+  for (const RuntimeFunction& support : runtime_support_functions) {
+    symbols[mangle(support.name)] = {
+        orc::ExecutorAddr::fromPtr(support.address), flags};
+  }
+  check(jit_->getMainJITDylib().define(
+      orc::absoluteSymbols(std::move(symbols))));
+}
+
+// Runs the module pipeline on the partition being compiled, which holds
+// the requested function and declarations of everything it calls.
+void JIT::optimize(Module& module) {
+  if (opt_level_ == OptLevel::O0) return;
+  PassBuilder pass_builder{target_machine_.get()};
+  LoopAnalysisManager loop_analyses;
+  FunctionAnalysisManager function_analyses;
+  CGSCCAnalysisManager cgscc_analyses;
+  ModuleAnalysisManager module_analyses;
+  pass_builder.registerModuleAnalyses(module_analyses);
+  pass_builder.registerCGSCCAnalyses(cgscc_analyses);
+  pass_builder.registerFunctionAnalyses(function_analyses);
+  pass_builder.registerLoopAnalyses(loop_analyses);
+  pass_builder.crossRegisterProxies(loop_analyses, function_analyses,
+                                    cgscc_analyses, module_analyses);
+  pass_builder
+      .buildPerModuleDefaultPipeline(get_optimization_level(opt_level_))
+      .run(module, module_analyses);
+}
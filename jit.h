@@ -0,0 +1,40 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Target/TargetMachine.h>
+
+#include "options.h"
+
+using namespace llvm;
+
+// Compiles modules in process with ORC, optimizing them at the selected
+// level. run_main() executes a lazily added program.
+class JIT {
+ public:
+  JIT(OptLevel level);
+
+  // the host target, for tuning the passes run during codegen
+  TargetMachine& target_machine();
+
+  // functions in the module are compiled when first called
+  void add_module(std::unique_ptr<LLVMContext> context,
+                  std::unique_ptr<Module> module);
+  // compiles the whole module now and returns the address of name
+  void* compile(std::unique_ptr<LLVMContext> context,
+                std::unique_ptr<Module> module, const std::string& name);
+  // calls the program's main and returns its result
+  int run_main();
+
+ private:
+  OptLevel opt_level_;
+  std::unique_ptr<TargetMachine> target_machine_;
+  std::unique_ptr<orc::LLLazyJIT> jit_;
+
+  void define_runtime_symbols();
+  void optimize(Module& module);
+};
@@ -1,19 +1,433 @@
-#include <fstream>
+#include <algorithm>
+#include <cstdlib>
+#include <exception>
+#include <new>
+#include <optional>
+#include <span>
+#include <unordered_set>
 
+#include <llvm/Support/FileSystem.h>
+
+#include "analysis.h"
+#include "astprinter.h"
+#include "bytecode.h"
+#include "cache.h"
 #include "codegen.h"
-#include "parser.h"
+#include "emitter.h"
+#include "engine.h"
+#include "jit.h"
+#include "options.h"
+#include "server.h"
+#include "session.h"
+#include "source.h"
+#include "threadpool.h"
+#include "timereport.h"
+#include "vm.h"
+#include "fmt.h"
+
+// cata's own operator new, counting for --time-report; here rather than in
+// the compiler library so programs embedding it keep their allocator. The
+// deletes pair with it, freeing what malloc and aligned_alloc returned.
+static void count_allocation(size_t size) {
+  if (counting_allocations.load(std::memory_order_relaxed)) [[unlikely]] {
+    ++thread_allocations;
+    thread_allocated_bytes += size;
+  }
+}
+
+static void* allocate(size_t size) {
+  count_allocation(size);
+  while (true) {
+    if (void* p = malloc(size ? size : 1)) return p;
+    std::new_handler handler = std::get_new_handler();
+    if (!handler) throw std::bad_alloc();
+    handler();
+  }
+}
+
+static void* allocate_aligned(size_t size, std::align_val_t align) {
+  count_allocation(size);
+  auto alignment = static_cast<size_t>(align);
+  // aligned_alloc wants a multiple of the alignment
+  size_t rounded =
+      (std::max<size_t>(size, 1) + alignment - 1) & ~(alignment - 1);
+  while (true) {
+    if (void* p = aligned_alloc(alignment, rounded)) return p;
+    std::new_handler handler = std::get_new_handler();
+    if (!handler) throw std::bad_alloc();
+    handler();
+  }
+}
+
+void* operator new(size_t size) {
+  return allocate(size);
+}
+
+void* operator new[](size_t size) {
+  return allocate(size);
+}
+
+void* operator new(size_t size, std::align_val_t align) {
+  return allocate_aligned(size, align);
+}
+
+void* operator new[](size_t size, std::align_val_t align) {
+  return allocate_aligned(size, align);
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p, size_t, std::align_val_t) noexcept {
+  free(p);
+}
+
+// cata run: the program starts running without waiting for the whole of
+// it to be compiled and optimized
+static int run(const Options& options) {
+  CompilerSession session{options};
+  session.add_file(options.input_files[0]);
+  std::span<ExprAST* const> items = session.items();
+  RunEngine run_engine = options.engine;
+  // arrays are memory, which only compiled code has
+  if (run_engine == RunEngine::Tiered && uses_arrays(items))
+    run_engine = RunEngine::JIT;
+  if (run_engine == RunEngine::VM) {
+    BytecodeProgram program = BytecodeCompiler{}.compile(items);
+    return VM{program}.run_main();
+  }
+  if (run_engine != RunEngine::JIT) {
+    Engine engine{items, session.symbols(), session.codegen(),
+                  options.opt_level, run_engine == RunEngine::Tiered};
+    return engine.run_main();
+  }
+  return session.jit()->run_main();
+}
+
+static void write_file(StringRef data, const std::string& file_name) {
+  std::error_code ec;
+  raw_fd_ostream os{file_name, ec};
+  if (ec)
+    error("could not open %s, %s", file_name.c_str(), ec.message().c_str());
+  os << data;
+}
+
+// A part of the program compiled to an object on its own.
+struct Unit {
+  std::vector<ExprAST*> items;
+  // set for units of one cached function
+  std::string key;
+  std::string object_file;
+  // object_file is the cache's entry, not a temporary
+  bool cached = false;
+};
+
+// Compiles the program as separate modules, each generated, optimized and
+// emitted by a thread of the pool. With a cache there is one unit per
+// function, so unchanged functions come from it; otherwise a few units per
+// thread, which keeps them all busy. Functions only inline others in their
+// unit.
+static void compile_separately(std::span<ExprAST* const> items,
+                               const Options& options, CompileCache* cache,
+                               const std::string& object_file) {
+  std::vector<std::string> keys;
+  if (cache) keys = cache->function_keys(items);
+  bool has_global_arrays = std::ranges::any_of(items, [](ExprAST* item) {
+    return item->kind() == ExprKind::Array;
+  });
+  // global arrays are internal to the first unit, with every function that
+  // may index them
+  std::vector<Unit> units(1);
+  std::vector<ExprAST*> functions;
+  std::vector<std::string> objects;
+  std::unordered_set<Symbol> defined;
+  for (size_t i = 0; i < items.size(); ++i) {
+    ExprAST* item = items[i];
+    if (item->kind() != ExprKind::Function ||
+        (has_global_arrays && uses_arrays(item))) {
+      units[0].items.push_back(item);
+      continue;
+    }
+    // each unit only checks its own
+    Symbol name = static_cast<FunctionAST*>(item)->prototype()->name();
+    if (!defined.insert(name).second)
+      error("redefinition of function, %s", name.str().c_str());
+    if (!cache) {
+      functions.push_back(item);
+    } else if (cache->contains(keys[i])) {
+      objects.push_back(cache->path(keys[i]));
+    } else {
+      units.push_back({{item}, keys[i]});
+    }
+  }
+
+  WorkStealingPool pool{options.threads};
+  size_t chunks = std::min(functions.size(), pool.size() * 4);
+  for (size_t chunk = 0; chunk < chunks; ++chunk) {
+    auto begin = functions.begin() + functions.size() * chunk / chunks;
+    auto end = functions.begin() + functions.size() * (chunk + 1) / chunks;
+    units.push_back({{begin, end}});
+  }
+  // a target machine and generator for each worker, none are shared
+  std::vector<std::unique_ptr<Emitter>> emitters;
+  std::vector<std::unique_ptr<Codegen>> codegens;
+  for (size_t i = 0; i < pool.size(); ++i) {
+    emitters.push_back(std::make_unique<Emitter>(options.opt_level));
+    Codegen& codegen = *codegens.emplace_back(std::make_unique<Codegen>());
+    codegen.set_opt_level(options.opt_level,
+                          &emitters.back()->target_machine());
+    if (!options.remarks.empty()) codegen.set_remarks(options.remarks);
+    // calls to other units go through declarations
+    for (ExprAST* item : items) {
+      if (item->kind() == ExprKind::Function)
+        codegen.declare(static_cast<FunctionAST*>(item)->prototype());
+      else if (item->kind() == ExprKind::Prototype)
+        codegen.declare(static_cast<PrototypeAST*>(item));
+    }
+  }
+  for (size_t i = 0; i < units.size(); ++i) {
+    if (units[i].items.empty()) continue;
+    pool.submit([&, i](size_t worker) {
+      Unit& unit = units[i];
+      Codegen& codegen = *codegens[worker];
+      {
+        TimeScope timing{"codegen"};
+        for (ExprAST* item : unit.items) {
+          codegen.visitNode(item);
+        }
+      }
+      codegen.optimize();
+      auto [context, module] = codegen.take_module();
+      SmallString<0> object;
+      raw_svector_ostream os{object};
+      emitters[worker]->emit(*module, EmitKind::Object, os);
+      if (!unit.key.empty() && cache->store(unit.key, object)) {
+        unit.object_file = cache->path(unit.key);
+        unit.cached = true;
+        return;
+      }
+      unit.object_file =
+          i == 0 ? object_file : object_file + "." + std::to_string(i) + ".o";
+      write_file(object, unit.object_file);
+    });
+  }
+  // the first unit's object stays, like a whole program's
+  auto remove_temporaries = [&] {
+    for (size_t i = 1; i < units.size(); ++i) {
+      if (!units[i].cached && !units[i].object_file.empty())
+        sys::fs::remove(units[i].object_file);
+    }
+  };
+  try {
+    pool.wait();
+    for (Unit& unit : units) {
+      if (!unit.object_file.empty()) objects.push_back(unit.object_file);
+    }
+    link_executable(objects, options.output_file);
+  } catch (...) {
+    remove_temporaries();
+    throw;
+  }
+  remove_temporaries();
+}
+
+// A file compiled by compile_files().
+struct FileOutput {
+  std::string file;
+  // file is the cache's entry, not a temporary
+  bool cached = false;
+  std::exception_ptr failure;
+};
+
+// Compiles one of several files to a module of its own, which only knows
+// the functions the file defines or declares.
+static void compile_file(const std::string& input_file, size_t index,
+                         const Options& options, CompileCache* cache,
+                         Emitter& emitter, FileOutput& output) {
+  bool link = options.emit == EmitKind::Executable;
+  SourceBuffer source = SourceBuffer::from_file(input_file);
+  std::string key;
+  // remarks come from running the passes
+  if (cache && link && options.remarks.empty()) {
+    key = cache->object_key(source.view());
+    if (cache->contains(key)) {
+      output.file = cache->path(key);
+      output.cached = true;
+      return;
+    }
+  }
+  CompilerSession session{options, &emitter};
+  session.add_source(std::move(source));
+  if (!link) {
+    output.file = emitted_file_name(options, input_file);
+    session.emit(options.emit, output.file);
+    return;
+  }
+  SmallString<0> object;
+  raw_svector_ostream os{object};
+  session.emit(EmitKind::Object, os);
+  if (!key.empty() && cache->store(key, object)) {
+    output.file = cache->path(key);
+    output.cached = true;
+    return;
+  }
+  output.file = options.output_file + "." + std::to_string(index) + ".o";
+  write_file(object, output.file);
+}
+
+// Compiles several files separately, jobs of them at a time, each thread
+// reusing its target setup for every file it takes; the first thread's is
+// emitter. An executable links their objects, with cached ones reused as
+// they are.
+static void compile_files(const Options& options, CompileCache* cache,
+                          Emitter& emitter) {
+  const std::vector<std::string>& files = options.input_files;
+  WorkStealingPool pool{options.jobs};
+  // a target machine for each worker, none are shared
+  std::vector<std::unique_ptr<Emitter>> emitters;
+  for (size_t i = 1; i < pool.size(); ++i) {
+    emitters.push_back(std::make_unique<Emitter>(options.opt_level));
+  }
+  std::vector<FileOutput> outputs(files.size());
+  for (size_t i = 0; i < files.size(); ++i) {
+    pool.submit([&, i](size_t worker) {
+      try {
+        compile_file(files[i], i, options, cache,
+                     worker == 0 ? emitter : *emitters[worker - 1],
+                     outputs[i]);
+      } catch (const std::exception& e) {
+        outputs[i].failure = std::make_exception_ptr(
+            std::runtime_error(files[i] + ": " + e.what()));
+      }
+    });
+  }
+  pool.wait();
+  bool link = options.emit == EmitKind::Executable;
+  auto remove_temporaries = [&] {
+    for (FileOutput& output : outputs) {
+      if (link && !output.cached && !output.file.empty())
+        sys::fs::remove(output.file);
+    }
+  };
+  // the first file's error, whichever thread finished first
+  for (FileOutput& output : outputs) {
+    if (!output.failure) continue;
+    remove_temporaries();
+    std::rethrow_exception(output.failure);
+  }
+  if (!link) return;
+  std::vector<std::string> objects;
+  for (FileOutput& output : outputs) {
+    objects.push_back(output.file);
+  }
+  link_executable(objects, options.output_file);
+  remove_temporaries();
+}
+
+// Compiles as options say, with emitter's target setup.
+static void compile(const Options& options, Emitter& emitter) {
+  if (options.input_files.size() > 1) {
+    std::optional<CompileCache> cache;
+    if (!options.cache_dir.empty())
+      cache.emplace(options.cache_dir, options, emitter.target_machine());
+    compile_files(options, cache ? &*cache : nullptr, emitter);
+    return;
+  }
+  bool link = options.emit == EmitKind::Executable;
+  std::string emitted_file =
+      link ? options.output_file + ".o" : options.output_file;
+  std::optional<CompileCache> cache;
+  std::string output_key;
+  if (!options.cache_dir.empty()) {
+    cache.emplace(options.cache_dir, options, emitter.target_machine());
+    // remarks come from running the passes
+    if (options.remarks.empty())
+      output_key = cache->output_key(
+          SourceBuffer::from_file(options.input_files[0]).view());
+    if (auto output = output_key.empty() ? nullptr : cache->load(output_key)) {
+      write_file(output->getBuffer(), options.output_file);
+      if (link)
+        sys::fs::setPermissions(options.output_file,
+                                sys::fs::all_read | sys::fs::all_exe |
+                                    sys::fs::owner_write);
+      return;
+    }
+  }
+  CompilerSession session{options, &emitter};
+  session.add_file(options.input_files[0], options.threads);
+  // other kinds of output are a single module
+  if (link && (cache || options.threads != 1)) {
+    compile_separately(session.items(), options, cache ? &*cache : nullptr,
+                       emitted_file);
+  } else {
+    session.emit(link ? EmitKind::Object : options.emit, emitted_file);
+    if (link) link_executable({emitted_file}, options.output_file);
+  }
+  if (output_key.empty() || options.output_file == "-") return;
+  // a miss only costs the next compile
+  if (auto output = MemoryBuffer::getFile(options.output_file,
+                                          /*IsText=*/false,
+                                          /*RequiresNullTerminator=*/false))
+    cache->store(output_key, (*output)->getBuffer());
+}
 
 int main(int argc, char* argv[]) {
-  std::ofstream output_file{"./ir/program.ll", std::fstream::trunc};
-  // Tokenizer tokenizer{"./program.cata"};
-  // while (Token token = tokenizer.next_token(true)) {
-  //   std::cout << token << " ";
-  // }
-  auto parser = Parser{"./program.cata"};
-  // Codegen::instance().visitNode(parser.definition().get());
-  // Codegen::instance().visitNode(parser.top_level().get());
-
-  // std::cout << Codegen::instance().get_ir() << std::endl;
-  output_file << Codegen::instance().get_ir() << std::endl;
-  system("cd ./ir/ && sh ./compile.sh");
+  Options options = parse_options(argc, argv);
+  // before any thread reads it
+  log_enabled = options.log;
+  if (!options.connect_socket.empty()) {
+    // the server parses the rest again, from our working directory
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i) {
+      if (!std::string_view{argv[i]}.starts_with("--connect"))
+        args.push_back(argv[i]);
+    }
+    return request_server(options.connect_socket, args);
+  }
+  if (!options.server_socket.empty())
+    return serve(options.server_socket, options.jobs, compile);
+  std::optional<TimeReport> report;
+  if (!options.time_report.empty()) {
+    report.emplace();
+    TimeReport::activate(&*report);
+  }
+  int status = 0;
+  if (options.run) {
+    status = run(options);
+  } else {
+    Emitter emitter{options.opt_level};
+    compile(options, emitter);
+  }
+  if (!report) return status;
+  TimeReport::activate(nullptr);
+  if (options.time_report == "-")
+    report->write_table(stderr);
+  else
+    report->write_trace(options.time_report);
+  return status;
 }
@@ -0,0 +1,184 @@
+#include <charconv>
+#include <filesystem>
+#include <string_view>
+#include <unordered_set>
+
+#include "cache.h"
+#include "fmt.h"
+#include "options.h"
+#include "server.h"
+
+static OptLevel parse_opt_level(std::string_view arg) {
+  if (arg == "-O0") return OptLevel::O0;
+  if (arg == "-O1") return OptLevel::O1;
+  if (arg == "-O2" || arg == "-O") return OptLevel::O2;
+  if (arg == "-O3") return OptLevel::O3;
+  if (arg == "-Os") return OptLevel::Os;
+  error("unknown optimization level, %s", arg.data());
+}
+
+static EmitKind parse_emit_kind(std::string_view kind) {
+  if (kind == "bc") return EmitKind::Bitcode;
+  if (kind == "ll") return EmitKind::IR;
+  if (kind == "obj") return EmitKind::Object;
+  if (kind == "asm") return EmitKind::Assembly;
+  error("unknown --emit kind, %s", kind.data());
+}
+
+static RunEngine parse_run_engine(std::string_view engine) {
+  if (engine == "tiered") return RunEngine::Tiered;
+  if (engine == "interp") return RunEngine::Interpreter;
+  if (engine == "vm") return RunEngine::VM;
+  if (engine == "jit") return RunEngine::JIT;
+  error("unknown --engine, %s", engine.data());
+}
+
+static uint64_t parse_count(std::string_view value, std::string_view arg) {
+  uint64_t count = 0;
+  auto [end, ec] =
+      std::from_chars(value.data(), value.data() + value.size(), count);
+  if (ec != std::errc{} || end != value.data() + value.size())
+    error("invalid number in %s", arg.data());
+  return count;
+}
+
+static uint32_t parse_jobs(std::string_view value, std::string_view arg) {
+  uint64_t jobs = parse_count(value, arg);
+  if (jobs > 1024) error("too many threads, %s", arg.data());
+  return static_cast<uint32_t>(jobs);
+}
+
+static const char* extension(EmitKind emit) {
+  switch (emit) {
+    case EmitKind::Executable:
+      return "";
+    case EmitKind::Bitcode:
+      return ".bc";
+    case EmitKind::IR:
+      return ".ll";
+    case EmitKind::Object:
+      return ".o";
+    case EmitKind::Assembly:
+      return ".s";
+  }
+  error("invalid emit kind");
+}
+
+std::string emitted_file_name(const Options& options,
+                              const std::string& input_file) {
+  return options.output_dir + "/" +
+         std::filesystem::path{input_file}.stem().string() +
+         extension(options.emit);
+}
+
+Options parse_options(int argc, char* argv[]) {
+  Options options;
+  bool has_jobs = false;
+  int first = 1;
+  if (argc > 1 && std::string_view(argv[1]) == "run") {
+    options.run = true;
+    first = 2;
+  }
+  for (int i = first; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (arg.starts_with("-O")) {
+      options.opt_level = parse_opt_level(arg);
+    } else if (arg == "--emit") {
+      options.emit = EmitKind::Bitcode;
+    } else if (arg.starts_with("--emit=")) {
+      options.emit = parse_emit_kind(arg.substr(7));
+    } else if (arg.starts_with("--engine=")) {
+      if (!options.run) error("--engine only applies to cata run");
+      options.engine = parse_run_engine(arg.substr(9));
+    } else if (arg.starts_with("--const-eval-steps=")) {
+      options.const_eval_steps = parse_count(arg.substr(19), arg);
+    } else if (arg == "--auto-memo") {
+      options.auto_memo = true;
+    } else if (arg == "--remarks") {
+      options.remarks = "loop-vectorize|loop-unroll";
+    } else if (arg.starts_with("--remarks=")) {
+      options.remarks = arg.substr(10);
+      if (options.remarks.empty()) error("missing pattern after --remarks=");
+    } else if (arg == "--time-report") {
+      options.time_report = "-";
+    } else if (arg.starts_with("--time-report=")) {
+      options.time_report = arg.substr(14);
+      if (options.time_report.empty())
+        error("missing file name after --time-report=");
+    } else if (arg == "--log") {
+      options.log = true;
+    } else if (arg == "--cache") {
+      options.cache_dir = default_cache_directory();
+    } else if (arg.starts_with("--cache-dir=")) {
+      options.cache_dir = arg.substr(12);
+      if (options.cache_dir.empty())
+        error("missing directory after --cache-dir=");
+    } else if (arg.starts_with("--threads=")) {
+      options.threads = parse_jobs(arg.substr(10), arg);
+    } else if (arg == "-j") {
+      if (++i == argc) error("missing job count after -j");
+      options.jobs = parse_jobs(argv[i], arg);
+      has_jobs = true;
+    } else if (arg.starts_with("-j")) {
+      options.jobs = parse_jobs(arg.substr(2), arg);
+      has_jobs = true;
+    } else if (arg == "--server") {
+      options.server_socket = default_socket_path();
+    } else if (arg.starts_with("--server=")) {
+      options.server_socket = arg.substr(9);
+      if (options.server_socket.empty())
+        error("missing socket after --server=");
+    } else if (arg == "--connect") {
+      options.connect_socket = default_socket_path();
+    } else if (arg.starts_with("--connect=")) {
+      options.connect_socket = arg.substr(10);
+      if (options.connect_socket.empty())
+        error("missing socket after --connect=");
+    } else if (arg == "-o") {
+      if (++i == argc) error("missing file name after -o");
+      options.output_file = argv[i];
+    } else if (arg.starts_with("-")) {
+      error("unknown option, %s", argv[i]);
+    } else {
+      options.input_files.emplace_back(arg);
+    }
+  }
+  if (!options.server_socket.empty()) {
+    if (options.run || !options.input_files.empty() ||
+        !options.connect_socket.empty())
+      error("--server takes requests from clients, drop the rest");
+    // a client per core unless told otherwise
+    if (!has_jobs) options.jobs = 0;
+  }
+  if (options.input_files.empty())
+    options.input_files.push_back("./program.cata");
+  bool separate = options.input_files.size() > 1;
+  if (options.run && separate) error("run takes a single file");
+  if (separate && options.threads != 1)
+    error("--threads splits a single file, use -j for several");
+  if (separate && options.emit != EmitKind::Executable) {
+    if (!options.output_file.empty())
+      error("-o names one output, drop it to emit several files to ./ir");
+    std::unordered_set<std::string> outputs;
+    for (const std::string& file : options.input_files) {
+      if (!outputs.insert(emitted_file_name(options, file)).second)
+        error("two input files would both be emitted to %s",
+              emitted_file_name(options, file).c_str());
+    }
+  }
+  // an executable is linked from an object file next to it, and is no use
+  // on a stream
+  if (!options.run && options.emit == EmitKind::Executable &&
+      options.output_file == "-")
+    error("-o - only streams --emit output, an executable needs a file");
+  if (options.run && (options.emit != EmitKind::Executable ||
+                      !options.output_file.empty()))
+    error("run does not write output, drop --emit and -o");
+  if (options.run && !options.cache_dir.empty())
+    error("run compiles in memory, drop --cache");
+  if (options.run && options.threads != 1)
+    error("run compiles lazily, drop --threads");
+  if (options.output_file.empty())
+    options.output_file = emitted_file_name(options, "program");
+  return options;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum class OptLevel { O0, O1, O2, O3, Os };
+
+// what the compiler writes: a linked executable, or one module as bitcode,
+// textual IR, an object file or assembly
+enum class EmitKind { Executable, Bitcode, IR, Object, Assembly };
+
+// how cata run executes the program: tiered interpreter and JITs, only the
+// interpreter, the bytecode VM, or the lazy JIT alone
+enum class RunEngine { Tiered, Interpreter, VM, JIT };
+
+struct Options {
+  // several are compiled separately, ./program.cata when none are given
+  std::vector<std::string> input_files{};
+  // "-" writes emitted kinds to stdout, not executables
+  std::string output_file{};
+  OptLevel opt_level{OptLevel::O2};
+  EmitKind emit{EmitKind::Executable};
+  // JIT compile and run the program instead of writing output
+  bool run{false};
+  RunEngine engine{RunEngine::Tiered};
+  // budget for evaluating each constant call at compile time, 0 disables
+  uint64_t const_eval_steps{10'000'000};
+  // memoize every pure recursive function, not only @memo ones
+  bool auto_memo{false};
+  // regex of the passes whose optimization remarks are printed, empty for
+  // none
+  std::string remarks{};
+  // where compiled functions and outputs are cached, empty for no cache
+  std::string cache_dir{};
+  // threads parsing large files and compiling an executable's functions,
+  // 0 for one per core
+  uint32_t threads{1};
+  // input files compiled at the same time, or clients served, 0 for one
+  // per core
+  uint32_t jobs{1};
+  // where output goes without -o
+  std::string output_dir{"./ir"};
+  // listen here for --connect clients, empty when not serving
+  std::string server_socket{};
+  // have the server listening here do the work, empty to do it ourselves
+  std::string connect_socket{};
+  // "-" prints a table of where the time went to stderr, a file name gets
+  // Chrome trace events, empty for no report
+  std::string time_report{};
+  // debug logging to stderr, for the whole process
+  bool log{false};
+};
+
+// cata [-O0|-O1|-O2|-O3|-Os] [--emit[=bc|ll|obj|asm]] [-o output] [-j N]
+//      [file...]
+// cata run [-O0|-O1|-O2|-O3|-Os] [--engine=tiered|interp|vm|jit] [file]
+//
+// Both also take --const-eval-steps=N, --auto-memo and --remarks[=regex].
+// A bare --remarks shows the loop vectorizer's and unroller's.
+// --time-report prints the time, allocations and memory of each phase and
+// the slowest functions, --time-report=file writes them as Chrome trace
+// events instead. --log turns on debug logging.
+//
+// Compiles take --cache-dir=DIR, or --cache for ~/.cache/cata, to reuse
+// the code of unchanged functions and programs. --threads=N parses large
+// files and generates and optimizes functions on N threads, --threads=0 on
+// every core; functions then only inline those compiled with them.
+//
+// A bare --emit writes bitcode. Without -o, output goes to ./ir/program,
+// with the extension of the emitted kind.
+//
+// Several files are compiled separately, each to a module of its own, -j N
+// of them at a time (-j 0 for one per core). An executable links them all,
+// calling across files through extern declarations; emitted kinds go to
+// ./ir, named after each file.
+//
+// cata --server[=socket] [-j N] keeps a process serving N clients at a
+// time, one per core by default, on a Unix socket. Any cata command with
+// --connect[=socket] has it carried out there, with the client's working
+// directory and standard streams, skipping process and target setup.
+Options parse_options(int argc, char* argv[]);
+
+// the stem of input_file in options.output_dir, with the extension of the
+// emitted kind
+std::string emitted_file_name(const Options& options,
+                              const std::string& input_file);
@@ -1,90 +1,107 @@
-#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <exception>
 #include <unordered_map>
 #include <unordered_set>
 
-#include "astprinter.h"
-#include "codegen.h"
 #include "fmt.h"
 #include "parser.h"
+#include "threadpool.h"
+#include "timereport.h"
 
-Parser::Parser(const std::string& file_name) : tokenizer_{file_name} {
-  ASTPrinter printer;
-  while (Token token = tokenizer_.next_token()) {
-    printer.clear();
-    tokenizer_.putback(token);
+Parser::Parser(const std::string& file_name, ASTContext& context)
+    : tokens_{file_name, context.symbols()}, context_{context} {}
+
+Parser::Parser(SourceBuffer source, ASTContext& context)
+    : tokens_{std::move(source), context.symbols()}, context_{context} {}
+
+std::vector<ExprAST*> Parser::parse() {
+  TimeScope timing{"parse"};
+  std::vector<ExprAST*> items;
+  while (Token token = tokens_.peek()) {
     log("Parsing %s", token.as_string().c_str());
-    std::unique_ptr<ExprAST> expr;
     switch (token.kind()) {
+      case Token::Kind::At:
       case Token::Kind::Def:
-        expr = definition();
+        items.push_back(definition());
         break;
       case Token::Kind::Extern:
-        expr = extern_proto();
+        items.push_back(extern_proto());
+        break;
+      case Token::Kind::Let:
+        items.push_back(global_array());
         break;
       default:
-        expr = top_level();
+        items.push_back(top_level());
         break;
     }
-    printer.visitNode(expr.get());
-    // std::cout << printer << "\n";
-    Codegen::instance().visitNode(expr.get());
   }
+  return items;
 }
 
 // literal ::= IntLiteral
-std::unique_ptr<ExprAST> Parser::literal() {
-  Token token = tokenizer_.next_token();
+ExprAST* Parser::literal() {
+  Token token = tokens_.next_token();
   if (token.kind() != Token::Kind::IntLiteral) {
-    error_expected(tokenizer_, token, "integer literal");
+    error_expected(tokens_, token, "integer literal");
   }
-  return std::make_unique<LiteralExprAST>(token.int_value());
+  return context_.make<LiteralExprAST>(token.int_value());
 }
 
 // paren ::= '(' binary ')'
-std::unique_ptr<ExprAST> Parser::paren() {
+ExprAST* Parser::paren() {
   expect(Token::Kind::LeftParen, "(");
   auto expr = binary();
-  if (!expr) error_expected(tokenizer_, tokenizer_.cur_token(), "expression");
+  if (!expr) error_expected(tokens_, tokens_.cur_token(), "expression");
   expect(Token::Kind::RightParen, ")");
   return expr;
 }
 
 // identifier ::= Identifier
+//            ::= Identifier '[' binary ']'
 //            ::= Identifier '(' (binary (',' binary)*)? ')'
-std::unique_ptr<ExprAST> Parser::identifier() {
-  Token token = tokenizer_.next_token();
+ExprAST* Parser::identifier() {
+  Token token = tokens_.next_token();
   if (token.kind() != Token::Kind::Identifier) {
-    error_expected(tokenizer_, token, "identifier");
+    error_expected(tokens_, token, "identifier");
+  }
+  Symbol name = token.symbol();
+  if (tokens_.peek().kind() == Token::Kind::LeftBracket) {
+    tokens_.next_token();
+    auto index = binary();
+    if (!index) error_expected(tokens_, tokens_.cur_token(), "index");
+    expect(Token::Kind::RightBracket, "]");
+    return context_.make<IndexExprAST>(name, index);
   }
-  std::string name = token.lexeme();
-  token = tokenizer_.next_token();
-  if (token.kind() != Token::Kind::LeftParen) {
-    tokenizer_.putback(token);
-    return std::make_unique<VariableExprAST>(name);
+  if (tokens_.peek().kind() != Token::Kind::LeftParen) {
+    return context_.make<VariableExprAST>(name);
   }
-  std::vector<std::unique_ptr<ExprAST>> args;
+  tokens_.next_token();
+  // arguments of nested calls share the stack, ours start at base
+  size_t base = expr_stack_.size();
   while (true) {
-    token = tokenizer_.next_token();
-    if (token.kind() == Token::Kind::RightParen) break;
-    tokenizer_.putback(token);
+    if (tokens_.peek().kind() == Token::Kind::RightParen) {
+      tokens_.next_token();
+      break;
+    }
     auto arg = binary();
-    if (!arg) error_expected(tokenizer_, tokenizer_.cur_token(), "expression");
-    args.push_back(std::move(arg));
-    token = tokenizer_.next_token();
+    if (!arg) error_expected(tokens_, tokens_.cur_token(), "expression");
+    expr_stack_.push_back(arg);
+    token = tokens_.next_token();
     if (token.kind() == Token::Kind::RightParen) break;
     if (token.kind() != Token::Kind::Comma) {
-      error_expected(tokenizer_, token, "comma or right parenthesis");
+      error_expected(tokens_, token, "comma or right parenthesis");
     }
   }
-  return std::make_unique<CallExprAST>(name, std::move(args));
+  return context_.make<CallExprAST>(name, pop_exprs(base));
 }
 
 // primary ::= literal
 //         ::= identifier
 //         ::= paren
-std::unique_ptr<ExprAST> Parser::primary() {
-  Token token = tokenizer_.next_token();
-  tokenizer_.putback(token);
+ExprAST* Parser::primary() {
+  Token token = tokens_.peek();
   switch (token.kind()) {
     case Token::Kind::Eof:
       return nullptr;
@@ -97,27 +114,28 @@ std::unique_ptr<ExprAST> Parser::primary() {
     case Token::Kind::If:
       return if_stmt();
     default:
-      error_expected(tokenizer_, token, "primary expression");
+      error_expected(tokens_, token, "primary expression");
   }
 }
 
 // prefix ::= primary
 //        ::= op prefix
-std::unique_ptr<ExprAST> Parser::prefix() {
+ExprAST* Parser::prefix() {
   static const std::unordered_set<Token::Kind> prefix_operators = {
       Token::Kind::Not, Token::Kind::Plus, Token::Kind::Minus,
       Token::Kind::Tilde};
-  Token op = tokenizer_.next_token();
+  Token op = tokens_.peek();
   if (prefix_operators.find(op.kind()) == prefix_operators.end()) {
-    tokenizer_.putback(op);
     return primary();
   }
+  tokens_.next_token();
   auto operand = prefix();
-  if (!operand) error_expected(tokenizer_, tokenizer_.cur_token(), "operand");
-  return std::make_unique<PrefixExprAST>(op.kind(), std::move(operand));
+  if (!operand) error_expected(tokens_, tokens_.cur_token(), "operand");
+  return context_.make<PrefixExprAST>(op.kind(), operand);
 }
 
-static int get_binary_precedence(const Tokenizer& tokenizer, const Token& op) {
+static int get_binary_precedence(const TokenBuffer& tokens,
+                                 const Token& op) {
   static const std::unordered_map<Token::Kind, int> operator_precedence = {
       // ! ~
       {Token::Kind::Not, 100},
@@ -155,50 +173,47 @@ static int get_binary_precedence(const Tokenizer& tokenizer, const Token& op) {
   };
   auto it = operator_precedence.find(op.kind());
   if (it == operator_precedence.end()) {
-    error_expected(tokenizer, op, "operator");
+    error_expected(tokens, op, "operator");
   }
   return it->second;
 }
 
 // binary ::= prefix
 //        ::= binary op binary
-std::unique_ptr<ExprAST> Parser::binary(int prev_precedence) {
+ExprAST* Parser::binary(int prev_precedence) {
   static auto is_terminator = [](Token::Kind kind) {
     return kind == Token::Kind::RightParen || kind == Token::Kind::RightBrace ||
-           kind == Token::Kind::Comma || kind == Token::Kind::Semicolon;
+           kind == Token::Kind::RightBracket || kind == Token::Kind::Comma ||
+           kind == Token::Kind::Semicolon;
   };
   auto lhs = prefix();
   if (!lhs) return nullptr;
-  Token op = tokenizer_.next_token();
-  if (is_terminator(op.kind())) {
-    tokenizer_.putback(op);
-    return lhs;
-  }
-  int precedence = get_binary_precedence(tokenizer_, op);
-  while (precedence > prev_precedence) {
+  while (true) {
+    Token op = tokens_.peek();
+    if (is_terminator(op.kind())) return lhs;
+    int precedence = get_binary_precedence(tokens_, op);
+    if (precedence <= prev_precedence) return lhs;
+    tokens_.next_token();
     auto rhs = binary(precedence);
-    if (!rhs) error_expected(tokenizer_, tokenizer_.cur_token(), "expression");
-    lhs = std::make_unique<BinaryExprAST>(op.kind(), std::move(lhs),
-                                          std::move(rhs));
-    op = tokenizer_.cur_token();
-    if (is_terminator(op.kind())) {
-      return lhs;
-    }
-    precedence = get_binary_precedence(tokenizer_, op);
+    if (!rhs) error_expected(tokens_, tokens_.cur_token(), "expression");
+    lhs = context_.make<BinaryExprAST>(op.kind(), lhs, rhs);
   }
-  return lhs;
 }
 
 // statement ::= if_stmt
+//           ::= while_stmt
+//           ::= for_stmt
 //           ::= let_stmt ';'
 //           ::= binary ';'
-std::unique_ptr<ExprAST> Parser::statement() {
-  Token token = tokenizer_.next_token();
-  tokenizer_.putback(token);
-  std::unique_ptr<ExprAST> stmt;
-  switch (token.kind()) {
+ExprAST* Parser::statement() {
+  ExprAST* stmt;
+  switch (tokens_.peek().kind()) {
     case Token::Kind::If:
       return if_stmt();
+    case Token::Kind::While:
+      return while_stmt();
+    case Token::Kind::For:
+      return for_stmt();
     case Token::Kind::Let:
       stmt = let_stmt();
       break;
@@ -211,127 +226,214 @@ std::unique_ptr<ExprAST> Parser::statement() {
 }
 
 // block ::= '{' statement* '}'
-std::unique_ptr<ExprAST> Parser::block() {
+ExprAST* Parser::block() {
   expect_lbrace();
-  std::vector<std::unique_ptr<ExprAST>> statements;
-  while (Token token = tokenizer_.next_token()) {
-    tokenizer_.putback(token);
+  size_t base = expr_stack_.size();
+  while (Token token = tokens_.peek()) {
     if (token.kind() == Token::Kind::RightBrace) break;
-    statements.push_back(statement());
+    expr_stack_.push_back(statement());
   }
   expect_rbrace();
-  return std::make_unique<BlockExprAST>(std::move(statements));
+  return context_.make<BlockExprAST>(pop_exprs(base));
 }
 
-// prototype ::= Identifier '(' (Identifier (',' Identifier)*)? ')'
-std::unique_ptr<PrototypeAST> Parser::prototype() {
-  Token token = tokenizer_.next_token();
+// prototype ::= Identifier '(' (param (',' param)*)? ')'
+// param ::= Identifier ('[' IntLiteral ']')?
+PrototypeAST* Parser::prototype() {
+  Token token = tokens_.next_token();
   if (token.kind() != Token::Kind::Identifier) {
-    error_expected(tokenizer_, token, "function name");
+    error_expected(tokens_, token, "function name");
   }
-  std::string name = token.lexeme();
+  Symbol name = token.symbol();
   expect(Token::Kind::LeftParen, "(");
-  std::vector<std::string> args;
+  size_t base = symbol_stack_.size();
+  std::vector<uint32_t> array_sizes;
+  bool has_arrays = false;
   while (true) {
     // get arg name or ')'
-    token = tokenizer_.next_token();
+    token = tokens_.next_token();
     if (token.kind() == Token::Kind::RightParen) break;
     if (token.kind() != Token::Kind::Identifier) {
-      error_expected(tokenizer_, token, "argument name");
+      error_expected(tokens_, token, "argument name");
+    }
+    symbol_stack_.push_back(token.symbol());
+    uint32_t array_size = 0;
+    if (tokens_.peek().kind() == Token::Kind::LeftBracket) {
+      array_size = parse_array_size(max_global_array_size);
+      has_arrays = true;
     }
-    args.push_back(token.lexeme());
+    array_sizes.push_back(array_size);
     // get ',' or ')'
-    token = tokenizer_.next_token();
+    token = tokens_.next_token();
     if (token.kind() == Token::Kind::RightParen) break;
     if (token.kind() != Token::Kind::Comma) {
-      error_expected(tokenizer_, token, "comma or right parenthesis");
+      error_expected(tokens_, token, "comma or right parenthesis");
     }
   }
-  return std::make_unique<PrototypeAST>(name, std::move(args));
+  auto args =
+      context_.make_array<Symbol>(std::span(symbol_stack_).subspan(base));
+  symbol_stack_.resize(base);
+  if (!has_arrays) return context_.make<PrototypeAST>(name, args);
+  return context_.make<PrototypeAST>(
+      name, args, context_.make_array<uint32_t>(array_sizes));
 }
 
-// definition ::= Def prototype block
-std::unique_ptr<ExprAST> Parser::definition() {
+// definition ::= ('@' Identifier)* Def prototype block
+ExprAST* Parser::definition() {
+  bool memoize = false;
+  while (tokens_.peek().kind() == Token::Kind::At) {
+    tokens_.next_token();
+    Token token = tokens_.next_token();
+    if (token.kind() != Token::Kind::Identifier) {
+      error_expected(tokens_, token, "attribute name");
+    }
+    if (token.lexeme() != "memo") {
+      error_expected(tokens_, token, "attribute, memo");
+    }
+    memoize = true;
+  }
   expect(Token::Kind::Def, "function definition");
   auto proto = prototype();
-  if (!proto) error_expected(tokenizer_, tokenizer_.cur_token(), "prototype");
+  if (!proto) error_expected(tokens_, tokens_.cur_token(), "prototype");
   auto body = block();
   if (!body)
-    error_expected(tokenizer_, tokenizer_.cur_token(), "body expression");
-  return std::make_unique<FunctionAST>(std::move(proto), std::move(body));
+    error_expected(tokens_, tokens_.cur_token(), "body expression");
+  auto function = context_.make<FunctionAST>(proto, body);
+  function->set_memoize(memoize);
+  return function;
 }
 
 // extern_proto ::= Extern prototype
-std::unique_ptr<ExprAST> Parser::extern_proto() {
+ExprAST* Parser::extern_proto() {
   expect(Token::Kind::Extern, "extern");
   auto proto = prototype();
-  if (!proto) error_expected(tokenizer_, tokenizer_.cur_token(), "prototype");
+  if (!proto) error_expected(tokens_, tokens_.cur_token(), "prototype");
   expect_semicolon();
   return proto;
 }
 
 // let_stmt ::= let Identifier '=' binary
-std::unique_ptr<ExprAST> Parser::let_stmt() {
+//          ::= let Identifier '[' IntLiteral ']'
+ExprAST* Parser::let_stmt() {
   expect(Token::Kind::Let, "let");
-  Token token = tokenizer_.next_token();
+  Token token = tokens_.next_token();
   if (token.kind() != Token::Kind::Identifier) {
-    error_expected(tokenizer_, token, "variable name");
+    error_expected(tokens_, token, "variable name");
   }
-  std::string name = token.lexeme();
-  token = tokenizer_.next_token();
-  tokenizer_.putback(token);
-  if (token.kind() == Token::Kind::Semicolon) {
-    return std::make_unique<LetExprAST>(name,
-                                        std::make_unique<LiteralExprAST>(0));
+  Symbol name = token.symbol();
+  if (tokens_.peek().kind() == Token::Kind::LeftBracket) {
+    return context_.make<ArrayExprAST>(
+        name, parse_array_size(max_stack_array_size), false);
+  }
+  if (tokens_.peek().kind() == Token::Kind::Semicolon) {
+    return context_.make<LetExprAST>(name, context_.make<LiteralExprAST>(0));
   }
   expect(Token::Kind::Equals, "=");
   auto expr = binary();
-  if (!expr) error_expected(tokenizer_, tokenizer_.cur_token(), "expression");
-  return std::make_unique<LetExprAST>(name, std::move(expr));
+  if (!expr) error_expected(tokens_, tokens_.cur_token(), "expression");
+  return context_.make<LetExprAST>(name, expr);
+}
+
+// global_array ::= let Identifier '[' IntLiteral ']' ';'
+ExprAST* Parser::global_array() {
+  expect(Token::Kind::Let, "let");
+  Token token = tokens_.next_token();
+  if (token.kind() != Token::Kind::Identifier) {
+    error_expected(tokens_, token, "array name");
+  }
+  if (tokens_.peek().kind() != Token::Kind::LeftBracket) {
+    error_expected(tokens_, tokens_.peek(), "array size, globals are arrays");
+  }
+  auto array = context_.make<ArrayExprAST>(
+      token.symbol(), parse_array_size(max_global_array_size), true);
+  expect_semicolon();
+  return array;
 }
 
 // if_stmt ::= If '(' binary ')' block ('else' (block | if_stmt))?
-std::unique_ptr<ExprAST> Parser::if_stmt() {
+ExprAST* Parser::if_stmt() {
   expect(Token::Kind::If, "if");
   expect_lparen();
   auto cond = binary();
-  if (!cond) error_expected(tokenizer_, tokenizer_.cur_token(), "condition");
+  if (!cond) error_expected(tokens_, tokens_.cur_token(), "condition");
   expect_rparen();
   auto then = block();
-  if (!then) error_expected(tokenizer_, tokenizer_.cur_token(), "then block");
+  if (!then) error_expected(tokens_, tokens_.cur_token(), "then block");
   // else block is optional
-  Token token = tokenizer_.next_token();
-  if (token.kind() != Token::Kind::Else) {
-    tokenizer_.putback(token);
-    return std::make_unique<IfExprAST>(std::move(cond), std::move(then),
-                                       nullptr);
+  if (tokens_.peek().kind() != Token::Kind::Else) {
+    return context_.make<IfExprAST>(cond, then, nullptr);
   }
-  token = tokenizer_.next_token();
-  tokenizer_.putback(token);
-  if (token.kind() == Token::Kind::If) {
-    return std::make_unique<IfExprAST>(std::move(cond), std::move(then),
-                                       if_stmt());
+  tokens_.next_token();
+  if (tokens_.peek().kind() == Token::Kind::If) {
+    return context_.make<IfExprAST>(cond, then, if_stmt());
   }
   auto els = block();
-  if (!els) error_expected(tokenizer_, tokenizer_.cur_token(), "else block");
-  return std::make_unique<IfExprAST>(std::move(cond), std::move(then),
-                                     std::move(els));
+  if (!els) error_expected(tokens_, tokens_.cur_token(), "else block");
+  return context_.make<IfExprAST>(cond, then, els);
 }
 
-std::unique_ptr<ExprAST> Parser::top_level() {
+// while_stmt ::= While '(' binary ')' block
+ExprAST* Parser::while_stmt() {
+  expect(Token::Kind::While, "while");
+  expect_lparen();
+  auto cond = binary();
+  if (!cond) error_expected(tokens_, tokens_.cur_token(), "condition");
+  expect_rparen();
+  auto body = block();
+  if (!body) error_expected(tokens_, tokens_.cur_token(), "loop body");
+  return context_.make<LoopExprAST>(nullptr, cond, nullptr, body);
+}
+
+// for_stmt ::= For '(' (let_stmt | binary)? ';' binary? ';' binary? ')' block
+ExprAST* Parser::for_stmt() {
+  expect(Token::Kind::For, "for");
+  expect_lparen();
+  ExprAST* init = nullptr;
+  if (tokens_.peek().kind() == Token::Kind::Let) {
+    init = let_stmt();
+  } else if (tokens_.peek().kind() != Token::Kind::Semicolon) {
+    init = binary();
+  }
+  expect_semicolon();
+  ExprAST* cond = nullptr;
+  if (tokens_.peek().kind() != Token::Kind::Semicolon) cond = binary();
+  expect_semicolon();
+  ExprAST* step = nullptr;
+  if (tokens_.peek().kind() != Token::Kind::RightParen) step = binary();
+  expect_rparen();
+  auto body = block();
+  if (!body) error_expected(tokens_, tokens_.cur_token(), "loop body");
+  return context_.make<LoopExprAST>(init, cond, step, body);
+}
+
+ExprAST* Parser::top_level() {
   error("top level expressions are not supported yet");
   // auto expr = binary();
   // if (!expr) return nullptr;
   // expect_semicolon();
-  // auto proto =
-  //     std::make_unique<PrototypeAST>("main", std::vector<std::string>{});
-  // return std::make_unique<FunctionAST>(std::move(proto), std::move(expr));
+  // auto name = context_.symbols().intern("main");
+  // auto proto = context_.make<PrototypeAST>(name, std::span<Symbol>{});
+  // return context_.make<FunctionAST>(proto, expr);
+}
+
+uint32_t Parser::parse_array_size(uint32_t max_size) {
+  expect(Token::Kind::LeftBracket, "[");
+  Token token = tokens_.next_token();
+  if (token.kind() != Token::Kind::IntLiteral) {
+    error_expected(tokens_, token, "array size");
+  }
+  if (token.int_value() <= 0 ||
+      static_cast<uint32_t>(token.int_value()) > max_size) {
+    error_expected(tokens_, token, "array size from 1 to %u", max_size);
+  }
+  expect(Token::Kind::RightBracket, "]");
+  return token.int_value();
 }
 
 void Parser::expect(Token::Kind kind, const std::string& what) {
-  Token token = tokenizer_.next_token();
+  Token token = tokens_.next_token();
   if (token.kind() != kind) {
-    error_expected(tokenizer_, token, "%s", what.c_str());
+    error_expected(tokens_, token, "%s", what.c_str());
   }
 }
 
@@ -355,31 +457,123 @@ void Parser::expect_semicolon() {
   expect(Token::Kind::Semicolon, "semicolon");
 }
 
-int interpret_expr(std::unique_ptr<ExprAST>& expr) {
-  switch (expr->kind()) {
-    case ExprKind::Binary: {
-      auto binary_expr = static_cast<BinaryExprAST*>(expr.get());
-      int lhs = interpret_expr(binary_expr->lhs());
-      int rhs = interpret_expr(binary_expr->rhs());
-      // std::cout << lhs << " " << Token(binary_expr->op()) << " " << rhs
-      //           << std::endl;
-      switch (binary_expr->op()) {
-        case Token::Kind::Plus:
-          return lhs + rhs;
-        case Token::Kind::Minus:
-          return lhs - rhs;
-        case Token::Kind::Star:
-          return lhs * rhs;
-        case Token::Kind::Slash:
-          return lhs / rhs;
-        default:
-          error("unexpected binary operator");
-      }
+std::span<ExprAST*> Parser::pop_exprs(size_t base) {
+  auto exprs = context_.make_array<ExprAST*>(
+      std::span(expr_stack_).subspan(base));
+  expr_stack_.resize(base);
+  return exprs;
+}
+
+namespace {
+
+// smaller files are not worth a thread
+constexpr size_t min_chunk_size = 64 * 1024;
+
+struct Chunk {
+  size_t begin;
+  size_t end;
+  int first_line;
+};
+
+// Splits source into at most count chunks of whole items, of about equal
+// size. Items end at a ';' or '}' outside braces, nothing else nests at
+// the top level, so skipping comments is all the lexing needed.
+// Unbalanced braces stop the splitting, the last chunk's parser reports
+// them.
+std::vector<Chunk> split_items(std::string_view source, size_t count) {
+  std::vector<Chunk> chunks;
+  size_t target = source.size() / count;
+  size_t begin = 0;
+  int begin_line = 1;
+  int line = 1;
+  int depth = 0;
+  const char* data = source.data();
+  size_t size = source.size();
+  for (size_t i = 0; i < size && chunks.size() + 1 < count; ++i) {
+    switch (data[i]) {
+      case '\n':
+        ++line;
+        continue;
+      case '/':
+        if (i + 1 < size && data[i + 1] == '/') {
+          // the newline is counted by the next iteration
+          auto eol = static_cast<const char*>(
+              memchr(data + i, '\n', size - i));
+          i = eol ? eol - data - 1 : size;
+        } else if (i + 1 < size && data[i + 1] == '*') {
+          size_t end = source.find("*/", i + 2);
+          if (end == std::string_view::npos) end = size;
+          line += std::count(data + i, data + end, '\n');
+          i = end + 1;
+        }
+        continue;
+      case '{':
+        ++depth;
+        continue;
+      case '}':
+        if (--depth < 0) i = size;
+        break;
+      case ';':
+        break;
+      default:
+        continue;
     }
-    case ExprKind::Literal: {
-      auto literal_expr = static_cast<LiteralExprAST*>(expr.get());
-      return literal_expr->value();
+    if (depth == 0 && i + 1 - begin >= target) {
+      chunks.push_back({begin, i + 1, begin_line});
+      begin = i + 1;
+      begin_line = line;
     }
   }
-  error("unexpected expression kind");
+  chunks.push_back({begin, size, begin_line});
+  return chunks;
+}
+
+}  // namespace
+
+std::vector<ExprAST*> parse_file(const std::string& file_name,
+                                 ASTContext& context, size_t threads) {
+  return parse_file(SourceBuffer::from_file(file_name), context, threads);
+}
+
+std::vector<ExprAST*> parse_file(SourceBuffer source, ASTContext& context,
+                                 size_t threads) {
+  if (threads == 1 || source.size() < 2 * min_chunk_size)
+    return Parser{std::move(source), context}.parse();
+  WorkStealingPool pool{threads};
+  std::vector<Chunk> chunks = split_items(
+      source.view(),
+      std::min(pool.size() * 4, source.size() / min_chunk_size));
+  // every chunk interns into the file's symbols
+  struct Result {
+    ASTContext context;
+    std::vector<ExprAST*> items;
+    std::exception_ptr failure;
+
+    explicit Result(SymbolTable& symbols) : context{symbols} {}
+  };
+  std::deque<Result> results;
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    results.emplace_back(context.symbols());
+  }
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    pool.submit([&, i](size_t) {
+      const Chunk& chunk = chunks[i];
+      Result& result = results[i];
+      try {
+        Parser parser{source.window(chunk.begin, chunk.end, chunk.first_line),
+                      result.context};
+        result.items = parser.parse();
+      } catch (...) {
+        result.failure = std::current_exception();
+      }
+    });
+  }
+  pool.wait();
+  std::vector<ExprAST*> items;
+  for (Result& result : results) {
+    if (result.failure) std::rethrow_exception(result.failure);
+    context.adopt(result.context);
+    items.insert(items.end(), result.items.begin(), result.items.end());
+  }
+  return items;
 }
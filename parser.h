@@ -1,38 +1,72 @@
 #pragma once
 
-#include <memory>
+#include <span>
+#include <string>
+#include <vector>
 
 #include "ast.h"
-#include "tokenizer.h"
+#include "astcontext.h"
+#include "tokenbuffer.h"
+
+// array elements are i32; stack arrays are kept well inside the default
+// 8 MiB stack, leaving room for recursion
+constexpr uint32_t max_stack_array_size = 1 << 16;
+constexpr uint32_t max_global_array_size = 1 << 28;
 
 class Parser {
  public:
-  Parser(const std::string& file_name);
-
-  std::unique_ptr<ExprAST> literal();
-  std::unique_ptr<ExprAST> paren();
-  std::unique_ptr<ExprAST> identifier();
-  std::unique_ptr<ExprAST> primary();
-  std::unique_ptr<ExprAST> prefix();
-  std::unique_ptr<ExprAST> binary(int prev_precedence = 0);
-  std::unique_ptr<ExprAST> statement();
-  std::unique_ptr<ExprAST> block();
-  std::unique_ptr<PrototypeAST> prototype();
-  std::unique_ptr<ExprAST> definition();
-  std::unique_ptr<ExprAST> extern_proto();
-  std::unique_ptr<ExprAST> let_stmt();
-  std::unique_ptr<ExprAST> if_stmt();
-  std::unique_ptr<ExprAST> top_level();
+  // nodes are allocated in context and names interned into its symbols,
+  // which must outlive them
+  Parser(const std::string& file_name, ASTContext& context);
+  Parser(SourceBuffer source, ASTContext& context);
+
+  // parses every top level item in the file
+  std::vector<ExprAST*> parse();
+
+  ExprAST* literal();
+  ExprAST* paren();
+  ExprAST* identifier();
+  ExprAST* primary();
+  ExprAST* prefix();
+  ExprAST* binary(int prev_precedence = 0);
+  ExprAST* statement();
+  ExprAST* block();
+  PrototypeAST* prototype();
+  ExprAST* definition();
+  ExprAST* extern_proto();
+  ExprAST* let_stmt();
+  ExprAST* if_stmt();
+  ExprAST* while_stmt();
+  ExprAST* for_stmt();
+  ExprAST* global_array();
+  ExprAST* top_level();
 
  private:
-  Tokenizer tokenizer_;
+  TokenBuffer tokens_;
+  ASTContext& context_;
+  // elements of the lists being parsed, nested lists push on top
+  std::vector<ExprAST*> expr_stack_;
+  std::vector<Symbol> symbol_stack_;
 
+  // `[size]`, a literal from 1 to max_size
+  uint32_t parse_array_size(uint32_t max_size);
   void expect(Token::Kind kind, const std::string& what);
   void expect_lparen();
   void expect_rparen();
   void expect_lbrace();
   void expect_rbrace();
   void expect_semicolon();
+
+  // moves the list elements above base into the context
+  std::span<ExprAST*> pop_exprs(size_t base);
 };
 
-int interpret_expr(std::unique_ptr<ExprAST>& expr);
+// Parses a file on up to threads threads, 0 for one per core. The top
+// level only holds definitions, externs and global arrays, so a prescan
+// matching braces splits large files between items into chunks, each
+// lexed and parsed into an arena of its own. Items are returned in source
+// order, and the first error in the file is the one reported.
+std::vector<ExprAST*> parse_file(const std::string& file_name,
+                                 ASTContext& context, size_t threads);
+std::vector<ExprAST*> parse_file(SourceBuffer source, ASTContext& context,
+                                 size_t threads);
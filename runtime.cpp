@@ -0,0 +1,25 @@
+#include "fmt.h"
+#include "runtime.h"
+
+int call_native(void* code, std::span<const int> a) {
+  switch (a.size()) {
+    case 0:
+      return reinterpret_cast<int (*)()>(code)();
+    case 1:
+      return reinterpret_cast<int (*)(int)>(code)(a[0]);
+    case 2:
+      return reinterpret_cast<int (*)(int, int)>(code)(a[0], a[1]);
+    case 3:
+      return reinterpret_cast<int (*)(int, int, int)>(code)(a[0], a[1], a[2]);
+    case 4:
+      return reinterpret_cast<int (*)(int, int, int, int)>(code)(a[0], a[1],
+                                                                  a[2], a[3]);
+    case 5:
+      return reinterpret_cast<int (*)(int, int, int, int, int)>(code)(
+          a[0], a[1], a[2], a[3], a[4]);
+    case 6:
+      return reinterpret_cast<int (*)(int, int, int, int, int, int)>(code)(
+          a[0], a[1], a[2], a[3], a[4], a[5]);
+  }
+  error("cannot call native code with %lu arguments", a.size());
+}
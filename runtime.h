@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+
+// The cata runtime, ir/lib.c. Compiled programs link against it, and the
+// JIT binds extern declarations to these definitions inside cata itself.
+extern "C" {
+int input();
+int print(int a);
+
+struct cata_memo;
+int cata_memo_lookup(cata_memo** table, const int* keys, int nargs,
+                     int* value);
+void cata_memo_store(cata_memo** table, const int* keys, int nargs,
+                     int value);
+[[noreturn]] void cata_bounds_fail(int index, int size);
+}
+
+struct RuntimeFunction {
+  const char* name;
+  void* address;
+};
+
+inline const RuntimeFunction runtime_functions[] = {
+    {"input", reinterpret_cast<void*>(&input)},
+    {"print", reinterpret_cast<void*>(&print)},
+};
+
+// called by generated code only, cata programs cannot declare them
+inline const RuntimeFunction runtime_support_functions[] = {
+    {"cata_memo_lookup", reinterpret_cast<void*>(&cata_memo_lookup)},
+    {"cata_memo_store", reinterpret_cast<void*>(&cata_memo_store)},
+    {"cata_bounds_fail", reinterpret_cast<void*>(&cata_bounds_fail)},
+};
+
+// native code is called through a fixed set of signatures
+constexpr size_t max_native_args = 6;
+
+// calls a function taking and returning ints, runtime or JIT compiled
+int call_native(void* code, std::span<const int> args);
@@ -0,0 +1,411 @@
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include "server.h"
+#include "threadpool.h"
+#include "fmt.h"
+
+extern char** environ;
+
+namespace {
+
+// requests are a command line, far below this
+constexpr uint32_t max_request_size = 1 << 20;
+constexpr int stream_count = 3;
+
+struct Request {
+  std::array<int, stream_count> streams{-1, -1, -1};
+  std::string working_directory;
+  std::vector<std::string> args;
+
+  ~Request() {
+    for (int fd : streams) {
+      if (fd >= 0) close(fd);
+    }
+  }
+};
+
+// a server's target setup for each level, made on first use
+using Emitters = std::array<std::unique_ptr<Emitter>, 5>;
+
+// path of a listening server, for the signal handler to remove
+char listening_path[sizeof(sockaddr_un::sun_path)];
+
+// whether the process at the other end of a connected socket runs as us;
+// requests carry file descriptors and paths, only our own are trusted
+bool same_user(int fd) {
+  ucred credentials{};
+  socklen_t size = sizeof credentials;
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &size) < 0)
+    return false;
+  return credentials.uid == getuid();
+}
+
+// where the default socket goes without $XDG_RUNTIME_DIR
+std::string fallback_socket_directory() {
+  return "/tmp/cata-" + std::to_string(getuid());
+}
+
+// makes directory, unless it exists, and checks that no one else can get
+// at it; in /tmp anyone could have made it first
+void make_private_directory(const std::string& directory) {
+  if (mkdir(directory.c_str(), 0700) < 0 && errno != EEXIST)
+    error("could not create %s, %s", directory.c_str(), strerror(errno));
+  struct stat status;
+  if (lstat(directory.c_str(), &status) < 0)
+    error("could not stat %s, %s", directory.c_str(), strerror(errno));
+  if (!S_ISDIR(status.st_mode) || status.st_uid != getuid() ||
+      (status.st_mode & 077))
+    error("%s is not a directory only we can use", directory.c_str());
+}
+
+sockaddr_un socket_address(const std::string& path) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path))
+    error("socket path is too long, %s", path.c_str());
+  memcpy(address.sun_path, path.c_str(), path.size() + 1);
+  return address;
+}
+
+bool read_all(int fd, void* data, size_t size) {
+  auto p = static_cast<char*>(data);
+  while (size > 0) {
+    ssize_t n = read(fd, p, size);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool write_all(int fd, const void* data, size_t size) {
+  auto p = static_cast<const char*>(data);
+  while (size > 0) {
+    ssize_t n = write(fd, p, size);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+// the size of the request, with our standard streams attached, then the
+// request
+void send_request(int fd, const std::string& request) {
+  uint32_t size = request.size();
+  iovec data{&size, sizeof size};
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * stream_count)]{};
+  msghdr message{};
+  message.msg_iov = &data;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof control;
+  cmsghdr* streams = CMSG_FIRSTHDR(&message);
+  streams->cmsg_level = SOL_SOCKET;
+  streams->cmsg_type = SCM_RIGHTS;
+  streams->cmsg_len = CMSG_LEN(sizeof(int) * stream_count);
+  int fds[stream_count] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  memcpy(CMSG_DATA(streams), fds, sizeof fds);
+  ssize_t sent;
+  do {
+    sent = sendmsg(fd, &message, 0);
+  } while (sent < 0 && errno == EINTR);
+  if (sent != sizeof size || !write_all(fd, request.data(), request.size()))
+    error("could not send the request, %s", strerror(errno));
+}
+
+bool receive_request(int fd, Request& request) {
+  uint32_t size;
+  iovec data{&size, sizeof size};
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * stream_count)];
+  msghdr message{};
+  message.msg_iov = &data;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof control;
+  ssize_t received;
+  do {
+    received = recvmsg(fd, &message, MSG_CMSG_CLOEXEC);
+  } while (received < 0 && errno == EINTR);
+  // a stream socket may split the size, but never before the first byte
+  if (received <= 0) return false;
+  // whatever descriptors came are ours to close, before anything is checked,
+  // and the padding of control may hold one more than we asked for
+  cmsghdr* streams = CMSG_FIRSTHDR(&message);
+  size_t stream_total = 0;
+  if (streams && streams->cmsg_level == SOL_SOCKET &&
+      streams->cmsg_type == SCM_RIGHTS && streams->cmsg_len >= CMSG_LEN(0)) {
+    stream_total = (streams->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (size_t i = 0; i < stream_total; ++i) {
+      int stream;
+      memcpy(&stream, CMSG_DATA(streams) + sizeof(int) * i, sizeof stream);
+      if (i < stream_count)
+        request.streams[i] = stream;
+      else
+        close(stream);
+    }
+  }
+  if ((message.msg_flags & MSG_CTRUNC) || stream_total != stream_count)
+    return false;
+  if (received < static_cast<ssize_t>(sizeof size) &&
+      !read_all(fd, reinterpret_cast<char*>(&size) + received,
+                sizeof size - received))
+    return false;
+  if (size > max_request_size) return false;
+  std::string payload(size, '\0');
+  if (!read_all(fd, payload.data(), size)) return false;
+  // the working directory, then the arguments, each ended by a null
+  size_t begin = 0;
+  for (size_t end; (end = payload.find('\0', begin)) != std::string::npos;
+       begin = end + 1) {
+    if (request.working_directory.empty())
+      request.working_directory = payload.substr(begin, end - begin);
+    else
+      request.args.push_back(payload.substr(begin, end - begin));
+  }
+  return !request.working_directory.empty();
+}
+
+int listen_on(const std::string& path) {
+  sockaddr_un address = socket_address(path);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) error("could not create a socket, %s", strerror(errno));
+  auto bound = [&] {
+    return bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof address) ==
+           0;
+  };
+  if (!bound()) {
+    if (errno != EADDRINUSE)
+      error("could not bind %s, %s", path.c_str(), strerror(errno));
+    // left by a server that was killed, unless one answers
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    bool live = connect(probe, reinterpret_cast<sockaddr*>(&address),
+                        sizeof address) == 0;
+    close(probe);
+    if (live) error("a server is already listening on %s", path.c_str());
+    unlink(path.c_str());
+    if (!bound())
+      error("could not bind %s, %s", path.c_str(), strerror(errno));
+  }
+  if (listen(fd, SOMAXCONN) < 0)
+    error("could not listen on %s, %s", path.c_str(), strerror(errno));
+  return fd;
+}
+
+void stop_serving(int signal) {
+  unlink(listening_path);
+  _exit(128 + signal);
+}
+
+// runs the program on the client's streams, returning its exit status
+int run_program(const std::string& program, const Request& request) {
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  for (int i = 0; i < stream_count; ++i) {
+    posix_spawn_file_actions_adddup2(&actions, request.streams[i], i);
+  }
+  posix_spawnattr_t attributes;
+  posix_spawnattr_init(&attributes);
+  // the server ignores SIGPIPE, programs should not
+  sigset_t defaults;
+  sigemptyset(&defaults);
+  sigaddset(&defaults, SIGPIPE);
+  posix_spawnattr_setsigdefault(&attributes, &defaults);
+  posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGDEF);
+  char* argv[] = {const_cast<char*>(program.c_str()), nullptr};
+  pid_t pid;
+  int failed =
+      posix_spawn(&pid, program.c_str(), &actions, &attributes, argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attributes);
+  if (failed) error("could not run %s, %s", program.c_str(), strerror(failed));
+  int status;
+  while (waitpid(pid, &status, 0) < 0) {
+    if (errno != EINTR) error("lost %s, %s", program.c_str(), strerror(errno));
+  }
+  if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+  return WEXITSTATUS(status);
+}
+
+std::string temporary_file(const char* suffix) {
+  SmallString<128> path;
+  if (std::error_code ec =
+          sys::fs::createTemporaryFile("cata", suffix, path))
+    error("could not create a temporary file, %s", ec.message().c_str());
+  return std::string{path};
+}
+
+// removes an output and the object left beside it
+void remove_output(const std::string& path) {
+  sys::fs::remove(path);
+  sys::fs::remove(path + ".o");
+}
+
+// carries out one command line, returning the exit status for the client
+int handle(const Request& request, Emitters& emitters,
+           const CompileFunction& compile) {
+  std::vector<char*> argv{const_cast<char*>("cata")};
+  for (const std::string& arg : request.args) {
+    argv.push_back(const_cast<char*>(arg.c_str()));
+  }
+  Options options = parse_options(argv.size(), argv.data());
+  if (!options.server_socket.empty() || !options.connect_socket.empty())
+    error("a request cannot serve or connect");
+  // only the standard streams are the client's
+  if (!options.remarks.empty() || !options.time_report.empty() || options.log)
+    error("reports go to the server's stderr, compile without --connect");
+  auto resolve = [&](std::string& path) {
+    if (path.empty() || path == "-") return;
+    SmallString<256> absolute{path};
+    sys::fs::make_absolute(request.working_directory, absolute);
+    path = std::string{absolute};
+  };
+  for (std::string& file : options.input_files) {
+    resolve(file);
+  }
+  resolve(options.output_file);
+  resolve(options.output_dir);
+  resolve(options.cache_dir);
+  auto& emitter = emitters[static_cast<size_t>(options.opt_level)];
+  if (!emitter) emitter = std::make_unique<Emitter>(options.opt_level);
+  if (options.run) {
+    // runs the program compiled ahead of time, on the client's streams
+    if (options.engine != RunEngine::Tiered)
+      error("--connect only runs compiled programs, drop --engine");
+    options.run = false;
+    options.output_file = temporary_file("");
+    int status;
+    try {
+      compile(options, *emitter);
+      status = run_program(options.output_file, request);
+    } catch (...) {
+      remove_output(options.output_file);
+      throw;
+    }
+    remove_output(options.output_file);
+    return status;
+  }
+  if (options.output_file != "-") {
+    compile(options, *emitter);
+    return 0;
+  }
+  // our stdout is not the client's
+  options.output_file = temporary_file("");
+  try {
+    compile(options, *emitter);
+    auto output = MemoryBuffer::getFile(options.output_file, /*IsText=*/false,
+                                        /*RequiresNullTerminator=*/false);
+    if (!output)
+      error("lost the output, %s", output.getError().message().c_str());
+    write_all(request.streams[1], (*output)->getBufferStart(),
+              (*output)->getBufferSize());
+  } catch (...) {
+    remove_output(options.output_file);
+    throw;
+  }
+  remove_output(options.output_file);
+  return 0;
+}
+
+void serve_client(int client, Emitters& emitters,
+                  const CompileFunction& compile) {
+  Request request;
+  if (same_user(client) && receive_request(client, request)) {
+    int32_t status;
+    try {
+      status = handle(request, emitters, compile);
+    } catch (const std::exception& e) {
+      std::string message = std::string{"cata: "} + e.what() + "\n";
+      write_all(request.streams[2], message.data(), message.size());
+      status = 1;
+    }
+    write_all(client, &status, sizeof status);
+  }
+  close(client);
+}
+
+}  // namespace
+
+std::string default_socket_path() {
+  if (const char* runtime = std::getenv("XDG_RUNTIME_DIR"); runtime && *runtime)
+    return std::string{runtime} + "/cata.sock";
+  return fallback_socket_directory() + "/server.sock";
+}
+
+int serve(const std::string& socket_path, size_t jobs,
+          const CompileFunction& compile) {
+  // a client that hangs up must not take the server with it
+  signal(SIGPIPE, SIG_IGN);
+  if (socket_path == fallback_socket_directory() + "/server.sock")
+    make_private_directory(fallback_socket_directory());
+  int listener = listen_on(socket_path);
+  memcpy(listening_path, socket_path.c_str(), socket_path.size() + 1);
+  signal(SIGINT, stop_serving);
+  signal(SIGTERM, stop_serving);
+  WorkStealingPool pool{jobs};
+  // the default level is ready for every thread before the first client
+  std::vector<Emitters> emitters(pool.size());
+  for (Emitters& worker : emitters) {
+    worker[static_cast<size_t>(OptLevel::O2)] =
+        std::make_unique<Emitter>(OptLevel::O2);
+  }
+  fprintf(stderr, "cata: serving %zu clients at a time on %s\n", pool.size(),
+          socket_path.c_str());
+  while (true) {
+    int client = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      error("could not accept clients, %s", strerror(errno));
+    }
+    pool.submit([&, client](size_t worker) {
+      serve_client(client, emitters[worker], compile);
+    });
+  }
+}
+
+int request_server(const std::string& socket_path,
+                   const std::vector<std::string>& args) {
+  sockaddr_un address = socket_address(socket_path);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) error("could not create a socket, %s", strerror(errno));
+  if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof address) < 0)
+    error("no server on %s, %s", socket_path.c_str(), strerror(errno));
+  // the request hands over our streams, never to another user's server
+  if (!same_user(fd))
+    error("the server on %s runs as another user", socket_path.c_str());
+  std::unique_ptr<char, decltype(&free)> working_directory{getcwd(nullptr, 0),
+                                                          &free};
+  if (!working_directory)
+    error("could not get the working directory, %s", strerror(errno));
+  std::string request = working_directory.get();
+  request += '\0';
+  for (const std::string& arg : args) {
+    request += arg;
+    request += '\0';
+  }
+  send_request(fd, request);
+  int32_t status;
+  if (!read_all(fd, &status, sizeof status))
+    error("the server hung up on %s", socket_path.c_str());
+  close(fd);
+  return status;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "emitter.h"
+#include "options.h"
+
+// does what a cata command without --connect would, with emitter set up
+// for options.opt_level
+using CompileFunction =
+    std::function<void(const Options& options, Emitter& emitter)>;
+
+// $XDG_RUNTIME_DIR/cata.sock, or /tmp/cata-<uid>/server.sock, where the
+// server makes the directory private to us
+std::string default_socket_path();
+
+// Serves clients on a Unix socket until killed, jobs at a time, 0 for one
+// per core. Each request is a cata command line, run with compile from
+// the client's working directory; programs the command runs use the
+// client's standard streams. Only clients running as our user are served,
+// and clients only talk to a server running as them. Threads keep their
+// target setup for every level they were asked for, so a request only
+// pays for compiling and linking; what a request interns is freed with its
+// session.
+int serve(const std::string& socket_path, size_t jobs,
+          const CompileFunction& compile);
+
+// Has the server at socket_path carry out args, a command line without the
+// program name, here and with our standard streams. Returns its exit
+// status.
+int request_server(const std::string& socket_path,
+                   const std::vector<std::string>& args);
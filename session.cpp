@@ -0,0 +1,99 @@
+#include "analysis.h"
+#include "constfold.h"
+#include "parser.h"
+#include "session.h"
+#include "timereport.h"
+#include "fmt.h"
+
+CompilerSession::CompilerSession(const Options& options, Emitter* emitter)
+    : options_{options}, emitter_{emitter} {
+  if (!emitter_) {
+    own_emitter_ = std::make_unique<Emitter>(options.opt_level);
+    emitter_ = own_emitter_.get();
+  }
+  codegen_.set_opt_level(options.opt_level, &emitter_->target_machine());
+  if (!options.remarks.empty()) codegen_.set_remarks(options.remarks);
+}
+
+void CompilerSession::add_file(const std::string& file_name,
+                               size_t threads) {
+  if (stage_ != Stage::Parsing)
+    error("%s added after the program was compiled", file_name.c_str());
+  std::vector<ExprAST*> items = parse_file(file_name, context_, threads);
+  items_.insert(items_.end(), items.begin(), items.end());
+}
+
+void CompilerSession::add_source(SourceBuffer source) {
+  if (stage_ != Stage::Parsing)
+    error("%s added after the program was compiled", source.name().c_str());
+  std::vector<ExprAST*> items = Parser{std::move(source), context_}.parse();
+  items_.insert(items_.end(), items.begin(), items.end());
+}
+
+std::span<ExprAST* const> CompilerSession::items() {
+  if (stage_ == Stage::Parsing) {
+    {
+      TimeScope timing{"fold constants"};
+      fold_constants(items_, context_, options_.const_eval_steps);
+    }
+    {
+      TimeScope timing{"analyze"};
+      select_memoized(items_, options_.auto_memo);
+    }
+    stage_ = Stage::Analyzed;
+  }
+  return items_;
+}
+
+SymbolTable& CompilerSession::symbols() {
+  return context_.symbols();
+}
+
+Codegen& CompilerSession::codegen() {
+  return codegen_;
+}
+
+TargetMachine& CompilerSession::target_machine() {
+  return emitter_->target_machine();
+}
+
+Module& CompilerSession::module() {
+  if (stage_ == Stage::Jitted) error("the program was moved to a JIT");
+  generate();
+  if (stage_ == Stage::Generated) {
+    codegen_.optimize();
+    stage_ = Stage::Optimized;
+  }
+  return codegen_.module();
+}
+
+void CompilerSession::emit(EmitKind kind, raw_pwrite_stream& os) {
+  emitter_->emit(module(), kind, os);
+}
+
+void CompilerSession::emit(EmitKind kind, const std::string& file_name) {
+  emitter_->emit(module(), kind, file_name);
+}
+
+std::unique_ptr<JIT> CompilerSession::jit() {
+  if (stage_ == Stage::Generated || stage_ == Stage::Optimized ||
+      stage_ == Stage::Jitted)
+    error("the program was already generated");
+  auto jit = std::make_unique<JIT>(options_.opt_level);
+  codegen_.set_opt_level(options_.opt_level, &jit->target_machine());
+  generate();
+  auto [context, module] = codegen_.take_module();
+  jit->add_module(std::move(context), std::move(module));
+  stage_ = Stage::Jitted;
+  return jit;
+}
+
+void CompilerSession::generate() {
+  items();
+  if (stage_ != Stage::Analyzed) return;
+  TimeScope timing{"codegen"};
+  for (ExprAST* item : items_) {
+    codegen_.visitNode(item);
+  }
+  stage_ = Stage::Generated;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+
+#include "ast.h"
+#include "astcontext.h"
+#include "codegen.h"
+#include "emitter.h"
+#include "jit.h"
+#include "options.h"
+#include "source.h"
+
+using namespace llvm;
+
+// One compilation of cata source, for embedding the compiler. A session
+// owns the AST and the symbols its names are interned into, a code
+// generator with its LLVM context, module and variable tables, and its
+// target machine, all freed with it. Sessions only share the lock every
+// target machine is made under, see target_setup_mutex. A process can run
+// any number of sessions, one after another or on several threads at once;
+// a single session is used by one thread at a time.
+class CompilerSession {
+ public:
+  // takes the options that affect code; emitter is target setup to reuse,
+  // which must outlive the session and not be used elsewhere meanwhile
+  explicit CompilerSession(const Options& options, Emitter* emitter = nullptr);
+  CompilerSession(const CompilerSession&) = delete;
+  CompilerSession& operator=(const CompilerSession&) = delete;
+
+  // parses source into the program, threads as for parse_file()
+  void add_file(const std::string& file_name, size_t threads = 1);
+  void add_source(SourceBuffer source);
+
+  // the whole program, with constants folded and memoized functions
+  // selected; sources can no longer be added
+  std::span<ExprAST* const> items();
+  // the names of the program, freed with the session
+  SymbolTable& symbols();
+  // the generator compiling the program, for the tiered engine
+  Codegen& codegen();
+  TargetMachine& target_machine();
+
+  // the program generated and optimized, once
+  Module& module();
+  // writes module() as kind, which must not be EmitKind::Executable
+  void emit(EmitKind kind, raw_pwrite_stream& os);
+  void emit(EmitKind kind, const std::string& file_name);
+  // moves the program, unoptimized, to a JIT of its own, which optimizes
+  // each function as it compiles it
+  std::unique_ptr<JIT> jit();
+
+ private:
+  enum class Stage { Parsing, Analyzed, Generated, Optimized, Jitted };
+
+  Options options_;
+  std::unique_ptr<Emitter> own_emitter_;
+  Emitter* emitter_;
+  // before the generator, which keeps pointers to prototypes in it
+  ASTContext context_;
+  std::vector<ExprAST*> items_;
+  Codegen codegen_;
+  Stage stage_{Stage::Parsing};
+
+  void generate();
+};
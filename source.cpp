@@ -0,0 +1,108 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fmt.h"
+#include "source.h"
+
+SourceBuffer SourceBuffer::from_file(const std::string& file_name) {
+  int fd = open(file_name.c_str(), O_RDONLY);
+  if (fd < 0) error("could not open file, %s", file_name.c_str());
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    error("could not stat file, %s", file_name.c_str());
+  }
+  SourceBuffer buffer;
+  buffer.name_ = file_name;
+  buffer.size_ = st.st_size;
+  // mmap rejects empty mappings, an empty file is just an empty buffer
+  if (buffer.size_ > 0) {
+    void* data = mmap(nullptr, buffer.size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      close(fd);
+      error("could not map file, %s", file_name.c_str());
+    }
+    madvise(data, buffer.size_, MADV_SEQUENTIAL);
+    buffer.data_ = static_cast<const char*>(data);
+    buffer.mapped_ = true;
+  } else {
+    buffer.data_ = buffer.owned_.data();
+  }
+  close(fd);
+  return buffer;
+}
+
+SourceBuffer SourceBuffer::from_string(std::string source,
+                                       const std::string& name) {
+  SourceBuffer buffer;
+  buffer.name_ = name;
+  buffer.owned_ = std::move(source);
+  buffer.data_ = buffer.owned_.data();
+  buffer.size_ = buffer.owned_.size();
+  return buffer;
+}
+
+SourceBuffer SourceBuffer::window(size_t begin, size_t end,
+                                  int first_line) const {
+  SourceBuffer buffer;
+  buffer.name_ = name_;
+  // neither mapped nor owned, so never released
+  buffer.data_ = data_ + begin;
+  buffer.size_ = end - begin;
+  buffer.first_line_ = first_line;
+  return buffer;
+}
+
+SourceBuffer::SourceBuffer(SourceBuffer&& other) noexcept {
+  *this = std::move(other);
+}
+
+SourceBuffer& SourceBuffer::operator=(SourceBuffer&& other) noexcept {
+  if (this == &other) return *this;
+  release();
+  bool owned = other.data_ == other.owned_.data();
+  name_ = std::move(other.name_);
+  size_ = other.size_;
+  mapped_ = other.mapped_;
+  owned_ = std::move(other.owned_);
+  first_line_ = other.first_line_;
+  // moving a short string copies its characters, so re-point at our copy
+  data_ = owned ? owned_.data() : other.data_;
+  other.data_ = nullptr;
+  other.size_ = 0;
+  other.mapped_ = false;
+  return *this;
+}
+
+SourceBuffer::~SourceBuffer() {
+  release();
+}
+
+const char* SourceBuffer::data() const {
+  return data_;
+}
+
+size_t SourceBuffer::size() const {
+  return size_;
+}
+
+std::string_view SourceBuffer::view() const {
+  return {data_, size_};
+}
+
+const std::string& SourceBuffer::name() const {
+  return name_;
+}
+
+int SourceBuffer::first_line() const {
+  return first_line_;
+}
+
+void SourceBuffer::release() {
+  if (mapped_) munmap(const_cast<char*>(data_), size_);
+  data_ = nullptr;
+  size_ = 0;
+  mapped_ = false;
+}
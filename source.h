@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// Read-only view of a whole source file. Files are memory mapped, so the
+// tokenizer can hand out string_views into the buffer instead of copying
+// every lexeme.
+class SourceBuffer {
+ public:
+  static SourceBuffer from_file(const std::string& file_name);
+  static SourceBuffer from_string(std::string source,
+                                  const std::string& name = "<string>");
+  // bytes [begin, end) of this buffer, which must outlive the window;
+  // first_line is the line begin is on, for diagnostics
+  SourceBuffer window(size_t begin, size_t end, int first_line) const;
+
+  SourceBuffer(SourceBuffer&& other) noexcept;
+  SourceBuffer& operator=(SourceBuffer&& other) noexcept;
+  SourceBuffer(const SourceBuffer&) = delete;
+  SourceBuffer& operator=(const SourceBuffer&) = delete;
+  ~SourceBuffer();
+
+  const char* data() const;
+  size_t size() const;
+  std::string_view view() const;
+  const std::string& name() const;
+  int first_line() const;
+
+ private:
+  std::string name_;
+  const char* data_{nullptr};
+  size_t size_{0};
+  // set when data_ points into an mmap-ed region
+  bool mapped_{false};
+  // backing storage for buffers that were not mapped
+  std::string owned_;
+  int first_line_{1};
+
+  SourceBuffer() = default;
+
+  void release();
+};
@@ -0,0 +1,91 @@
+#include <iostream>
+#include <mutex>
+
+#include "symbol.h"
+
+namespace {
+
+// the name of the empty symbol
+const std::string empty_name;
+
+}  // namespace
+
+Symbol::Symbol(uint32_t id, const std::string* name)
+    : id_{id}, name_{name} {}
+
+uint32_t Symbol::id() const {
+  return id_;
+}
+
+const std::string& Symbol::str() const {
+  return name_ ? *name_ : empty_name;
+}
+
+Symbol::operator bool() const {
+  return id_ != 0;
+}
+
+std::ostream& operator<<(std::ostream& os, Symbol symbol) {
+  return os << symbol.str();
+}
+
+SymbolTable::SymbolTable() {
+  slot(0) = &empty_name;
+}
+
+SymbolTable::~SymbolTable() {
+  for (auto& chunk : chunks_) delete[] chunk.load(std::memory_order_relaxed);
+}
+
+Symbol SymbolTable::intern(std::string_view name) {
+  Shard& shard = this->shard(name);
+  {
+    std::shared_lock lock{shard.mutex};
+    if (auto it = shard.ids.find(name); it != shard.ids.end())
+      return symbol(it->second);
+  }
+  std::lock_guard lock{shard.mutex};
+  if (auto it = shard.ids.find(name); it != shard.ids.end())
+    return symbol(it->second);
+  uint32_t id = next_id_.fetch_add(1, std::memory_order_relaxed);
+  // deque elements never move, so the key and the slot can view the
+  // stored name; the slot is written before the id is handed out
+  const std::string& stored = shard.names.emplace_back(name);
+  slot(id) = &stored;
+  shard.ids.emplace(stored, id);
+  return {id, &stored};
+}
+
+Symbol SymbolTable::find(std::string_view name) {
+  Shard& shard = this->shard(name);
+  std::shared_lock lock{shard.mutex};
+  auto it = shard.ids.find(name);
+  if (it == shard.ids.end()) return {};
+  return symbol(it->second);
+}
+
+Symbol SymbolTable::symbol(uint32_t id) {
+  return {id, slot(id)};
+}
+
+SymbolTable::Shard& SymbolTable::shard(std::string_view name) {
+  return shards_[std::hash<std::string_view>{}(name) % shard_count];
+}
+
+const std::string*& SymbolTable::slot(uint32_t id) {
+  size_t position = size_t{id} + first_chunk_size;
+  size_t chunk = std::bit_width(position) - std::bit_width(first_chunk_size);
+  return chunk_for(chunk)[position - (first_chunk_size << chunk)];
+}
+
+// made by whichever thread needs it first
+const std::string** SymbolTable::chunk_for(size_t chunk) {
+  const std::string** slots = chunks_[chunk].load(std::memory_order_acquire);
+  if (slots) return slots;
+  auto* fresh = new const std::string*[first_chunk_size << chunk]{};
+  if (chunks_[chunk].compare_exchange_strong(slots, fresh,
+                                             std::memory_order_acq_rel))
+    return fresh;
+  delete[] fresh;
+  return slots;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iosfwd>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// An interned identifier. Every distinct name maps to one dense id within
+// the SymbolTable that interned it, so later phases compare and hash
+// integers, and can index tables by id(). A symbol views its table, which
+// must outlive it.
+class Symbol {
+ public:
+  Symbol() = default;
+
+  uint32_t id() const;
+  const std::string& str() const;
+
+  explicit operator bool() const;
+  bool operator==(const Symbol& other) const = default;
+
+  friend std::ostream& operator<<(std::ostream& os, Symbol symbol);
+
+ private:
+  friend class SymbolTable;
+
+  Symbol(uint32_t id, const std::string* name);
+
+  // 0 is reserved for the empty symbol
+  uint32_t id_{0};
+  const std::string* name_{nullptr};
+};
+
+template <>
+struct std::hash<Symbol> {
+  size_t operator()(Symbol symbol) const { return symbol.id(); }
+};
+
+// The names of one compilation, freed with it. Names are split between
+// shards by hash, so lexers on several threads rarely wait for each other,
+// and a name seen before only takes its shard's lock shared. Ids come from
+// one counter and stay dense; id to name goes through chunks of doubling
+// size that never move once made, read without a lock.
+class SymbolTable {
+ public:
+  SymbolTable();
+  ~SymbolTable();
+  SymbolTable(const SymbolTable&) = delete;
+  SymbolTable& operator=(const SymbolTable&) = delete;
+
+  // thread safe
+  Symbol intern(std::string_view name);
+  // the symbol of a name interned before, empty otherwise
+  Symbol find(std::string_view name);
+  // by the id of a symbol from this table
+  Symbol symbol(uint32_t id);
+
+ private:
+  static constexpr size_t shard_count = 64;
+  // chunk k holds first_chunk_size << k ids, enough chunks for every
+  // uint32_t id
+  static constexpr size_t first_chunk_size = 1024;
+  static constexpr size_t chunk_count = 34 - std::bit_width(first_chunk_size);
+
+  struct Shard {
+    std::shared_mutex mutex;
+    std::deque<std::string> names;
+    std::unordered_map<std::string_view, uint32_t> ids;
+  };
+
+  std::array<Shard, shard_count> shards_;
+  std::atomic<uint32_t> next_id_{1};
+  std::array<std::atomic<const std::string**>, chunk_count> chunks_{};
+
+  Shard& shard(std::string_view name);
+  const std::string*& slot(uint32_t id);
+  const std::string** chunk_for(size_t chunk);
+};
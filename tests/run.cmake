@@ -0,0 +1,40 @@
+# cmake -DCATA=<cata> -DENGINE=<engine> -DSOURCE=<name>.cata
+#       [-DREJECTED=<message>] -P run.cmake
+#
+# Runs SOURCE with cata run --engine=ENGINE, feeding it <name>.in if there
+# is one, and fails unless it prints <name>.out exactly. With REJECTED the
+# engine must refuse the program instead, with an error containing it.
+
+get_filename_component(dir ${SOURCE} DIRECTORY)
+get_filename_component(name ${SOURCE} NAME_WE)
+set(input /dev/null)
+if(EXISTS ${dir}/${name}.in)
+  set(input ${dir}/${name}.in)
+endif()
+
+execute_process(
+  COMMAND ${CATA} run --engine=${ENGINE} ${SOURCE}
+  INPUT_FILE ${input}
+  OUTPUT_VARIABLE output
+  ERROR_VARIABLE errors
+  RESULT_VARIABLE result
+  TIMEOUT 60)
+
+if(DEFINED REJECTED)
+  string(FIND "${errors}" "${REJECTED}" found)
+  if(result EQUAL 0 OR found EQUAL -1)
+    message(FATAL_ERROR
+      "${ENGINE} should refuse ${name} with \"${REJECTED}\", got ${result}:\n"
+      "${errors}")
+  endif()
+  return()
+endif()
+
+if(NOT result EQUAL 0)
+  message(FATAL_ERROR "${ENGINE} failed on ${name}, ${result}:\n${errors}")
+endif()
+file(READ ${dir}/${name}.out expected)
+if(NOT output STREQUAL expected)
+  message(FATAL_ERROR
+    "${ENGINE} printed, for ${name}:\n${output}\nexpected:\n${expected}")
+endif()
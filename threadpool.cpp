@@ -0,0 +1,104 @@
+#include <algorithm>
+#include <utility>
+
+#include "threadpool.h"
+
+WorkStealingPool::WorkStealingPool(size_t threads) {
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  for (size_t i = 0; i < threads; ++i) {
+    workers_.push_back(std::make_unique<Worker>());
+  }
+  // started once every deque exists, thieves look at all of them
+  for (size_t i = 0; i < threads; ++i) {
+    workers_[i]->thread = std::thread{&WorkStealingPool::run, this, i};
+  }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  {
+    std::lock_guard lock{mutex_};
+    stopping_ = true;
+  }
+  work_ready_.notify_all();
+  for (auto& worker : workers_) {
+    worker->thread.join();
+  }
+}
+
+size_t WorkStealingPool::size() const {
+  return workers_.size();
+}
+
+void WorkStealingPool::submit(Task task) {
+  Worker& worker = *workers_[next_worker_];
+  next_worker_ = (next_worker_ + 1) % workers_.size();
+  {
+    // counted before any worker can finish it, and queued under mutex_, so
+    // a worker about to sleep cannot miss it
+    std::lock_guard lock{mutex_};
+    ++pending_;
+    std::lock_guard worker_lock{worker.mutex};
+    worker.tasks.push_back(std::move(task));
+  }
+  work_ready_.notify_one();
+}
+
+void WorkStealingPool::wait() {
+  std::unique_lock lock{mutex_};
+  done_.wait(lock, [this] { return pending_ == 0; });
+  if (std::exception_ptr failure = std::exchange(failure_, nullptr))
+    std::rethrow_exception(failure);
+}
+
+void WorkStealingPool::run(size_t index) {
+  Task task;
+  while (true) {
+    if (take(index, task)) {
+      try {
+        task(index);
+      } catch (...) {
+        std::lock_guard lock{mutex_};
+        if (!failure_) failure_ = std::current_exception();
+      }
+      task = nullptr;
+      std::lock_guard lock{mutex_};
+      if (--pending_ == 0) done_.notify_all();
+      continue;
+    }
+    std::unique_lock lock{mutex_};
+    if (stopping_) return;
+    // submit() queues under mutex_, so a task queued after the check above
+    // is seen here or wakes the worker
+    work_ready_.wait(lock, [&] {
+      if (stopping_) return true;
+      for (auto& worker : workers_) {
+        std::lock_guard worker_lock{worker->mutex};
+        if (!worker->tasks.empty()) return true;
+      }
+      return false;
+    });
+  }
+}
+
+bool WorkStealingPool::take(size_t index, Task& task) {
+  {
+    Worker& own = *workers_[index];
+    std::lock_guard lock{own.mutex};
+    if (!own.tasks.empty()) {
+      task = std::move(own.tasks.back());
+      own.tasks.pop_back();
+      return true;
+    }
+  }
+  for (size_t i = 1; i < workers_.size(); ++i) {
+    Worker& victim = *workers_[(index + i) % workers_.size()];
+    std::lock_guard lock{victim.mutex};
+    if (!victim.tasks.empty()) {
+      task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs tasks on a fixed set of threads. Each worker has a deque of its
+// own, takes its newest task first and, once it runs dry, steals the
+// oldest from the others, so uneven tasks keep every thread busy.
+class WorkStealingPool {
+ public:
+  // the task is told the index of the worker running it, for per thread
+  // state
+  using Task = std::function<void(size_t worker)>;
+
+  // 0 threads means one per core
+  explicit WorkStealingPool(size_t threads);
+  WorkStealingPool(const WorkStealingPool&) = delete;
+  WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+  ~WorkStealingPool();
+
+  size_t size() const;
+  void submit(Task task);
+  // blocks until every submitted task is done, then rethrows the first
+  // exception a task threw
+  void wait();
+
+ private:
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+    std::thread thread;
+  };
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  size_t next_worker_{0};
+  // guards the members below
+  std::mutex mutex_;
+  // submitted but not yet finished
+  size_t pending_{0};
+  std::condition_variable work_ready_, done_;
+  bool stopping_{false};
+  std::exception_ptr failure_;
+
+  void run(size_t index);
+  bool take(size_t index, Task& task);
+};
@@ -0,0 +1,185 @@
+#include <sys/resource.h>
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <unordered_map>
+
+#include "fmt.h"
+#include "timereport.h"
+
+namespace {
+
+TimeReport* active_report = nullptr;
+
+uint32_t thread_index() {
+  static std::atomic<uint32_t> threads{0};
+  thread_local uint32_t index = threads++;
+  return index;
+}
+
+int64_t thread_cpu_us() {
+  timespec time;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+  return time.tv_sec * 1'000'000 + time.tv_nsec / 1000;
+}
+
+int64_t peak_rss_kb() {
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+// one row of the table, the events of a phase or a function summed
+struct Totals {
+  uint32_t calls = 0;
+  int64_t wall_us = 0;
+  int64_t cpu_us = 0;
+  uint64_t allocations = 0;
+  uint64_t allocated_bytes = 0;
+  int64_t peak_rss_kb = 0;
+
+  void add(const TimeReport::Event& event) {
+    ++calls;
+    wall_us += event.wall_us;
+    cpu_us += event.cpu_us;
+    allocations += event.allocations;
+    allocated_bytes += event.allocated_bytes;
+    peak_rss_kb = std::max(peak_rss_kb, event.peak_rss_kb);
+  }
+};
+
+void write_row(FILE* out, const std::string& name, const Totals& totals) {
+  fprintf(out, "  %-24s %7u %10.2f %10.2f %10llu %10.2f %10.1f\n",
+          name.c_str(), totals.calls, totals.wall_us / 1000.0,
+          totals.cpu_us / 1000.0,
+          static_cast<unsigned long long>(totals.allocations),
+          totals.allocated_bytes / 1048576.0, totals.peak_rss_kb / 1024.0);
+}
+
+// functions in the table, the slowest first
+constexpr size_t reported_functions = 10;
+
+}  // namespace
+
+TimeReport::TimeReport() : start_{std::chrono::steady_clock::now()} {}
+
+TimeReport* TimeReport::active() {
+  return active_report;
+}
+
+void TimeReport::activate(TimeReport* report) {
+  active_report = report;
+  counting_allocations.store(report != nullptr, std::memory_order_relaxed);
+}
+
+void TimeReport::record(const Event& event) {
+  std::lock_guard lock{mutex_};
+  events_.push_back(event);
+  // the session that named the function may be gone by the time the
+  // report is written
+  if (event.function)
+    events_.back().function = functions_.intern(event.function.str());
+}
+
+int64_t TimeReport::now_us() const {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - start_)
+      .count();
+}
+
+void TimeReport::write_table(FILE* out) const {
+  std::lock_guard lock{mutex_};
+  std::vector<const char*> phases;
+  std::unordered_map<std::string, Totals> phase_totals;
+  std::unordered_map<Symbol, Totals> function_totals;
+  for (const Event& event : events_) {
+    if (event.function) {
+      function_totals[event.function].add(event);
+      continue;
+    }
+    auto [it, inserted] = phase_totals.try_emplace(event.phase);
+    if (inserted) phases.push_back(event.phase);
+    it->second.add(event);
+  }
+  // recorded when they end, so order by the first start
+  auto first_start = [&](const char* phase) {
+    int64_t start = INT64_MAX;
+    for (const Event& event : events_) {
+      if (!event.function && std::string_view{event.phase} == phase)
+        start = std::min(start, event.start_us);
+    }
+    return start;
+  };
+  std::stable_sort(phases.begin(), phases.end(),
+                   [&](const char* a, const char* b) {
+                     return first_start(a) < first_start(b);
+                   });
+  fprintf(out, "  %-24s %7s %10s %10s %10s %10s %10s\n", "phase", "calls",
+          "wall ms", "cpu ms", "allocs", "alloc MB", "peak MB");
+  for (const char* phase : phases) {
+    write_row(out, phase, phase_totals[phase]);
+  }
+  if (!function_totals.empty()) {
+    std::vector<std::pair<Symbol, Totals>> functions(function_totals.begin(),
+                                                     function_totals.end());
+    size_t shown = std::min(functions.size(), reported_functions);
+    std::partial_sort(functions.begin(), functions.begin() + shown,
+                      functions.end(), [](const auto& a, const auto& b) {
+                        return a.second.wall_us > b.second.wall_us;
+                      });
+    fprintf(out, "  %-24s %7s %10s %10s %10s %10s %10s\n",
+            "slowest functions", "", "", "", "", "", "");
+    for (size_t i = 0; i < shown; ++i) {
+      write_row(out, functions[i].first.str(), functions[i].second);
+    }
+  }
+  fprintf(out, "  total %.2f ms wall, peak RSS %.1f MB\n", now_us() / 1000.0,
+          peak_rss_kb() / 1024.0);
+}
+
+void TimeReport::write_trace(const std::string& file_name) const {
+  FILE* out = fopen(file_name.c_str(), "w");
+  if (!out) error("could not open %s", file_name.c_str());
+  std::lock_guard lock{mutex_};
+  fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  for (size_t i = 0; i < events_.size(); ++i) {
+    const Event& event = events_[i];
+    // phases and identifiers need no escaping
+    fprintf(out,
+            "%s\n{\"name\":\"%s%s%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,"
+            "\"tid\":%u,\"ts\":%lld,\"dur\":%lld,\"args\":{\"cpu_us\":%lld,"
+            "\"allocations\":%llu,\"allocated_bytes\":%llu,"
+            "\"peak_rss_kb\":%lld}}",
+            i ? "," : "", event.phase, event.function ? " " : "",
+            event.function ? event.function.str().c_str() : "",
+            event.function ? "function" : "phase", event.thread,
+            static_cast<long long>(event.start_us),
+            static_cast<long long>(event.wall_us),
+            static_cast<long long>(event.cpu_us),
+            static_cast<unsigned long long>(event.allocations),
+            static_cast<unsigned long long>(event.allocated_bytes),
+            static_cast<long long>(event.peak_rss_kb));
+  }
+  fprintf(out, "\n]}\n");
+  if (fclose(out) != 0) error("could not write %s", file_name.c_str());
+}
+
+void TimeScope::begin(const char* phase, Symbol function) {
+  event_.phase = phase;
+  event_.function = function;
+  event_.thread = thread_index();
+  event_.start_us = report_->now_us();
+  event_.cpu_us = thread_cpu_us();
+  event_.allocations = thread_allocations;
+  event_.allocated_bytes = thread_allocated_bytes;
+}
+
+void TimeScope::end() {
+  event_.wall_us = report_->now_us() - event_.start_us;
+  event_.cpu_us = thread_cpu_us() - event_.cpu_us;
+  event_.allocations = thread_allocations - event_.allocations;
+  event_.allocated_bytes = thread_allocated_bytes - event_.allocated_bytes;
+  event_.peak_rss_kb = peak_rss_kb();
+  report_->record(event_);
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "symbol.h"
+
+// Heap allocations of the calling thread, counted while a report is active
+// by the operator new that cata replaces in main.cpp. Other programs
+// linking the compiler keep their own and report none.
+inline std::atomic<bool> counting_allocations{false};
+inline thread_local uint64_t thread_allocations = 0;
+inline thread_local uint64_t thread_allocated_bytes = 0;
+
+// Wall and CPU time, heap allocations and peak RSS of each phase of the
+// compiler and of each function, for --time-report. Phases are timed by
+// TimeScope, which costs a null check while no report is active.
+class TimeReport {
+ public:
+  // one finished scope
+  struct Event {
+    const char* phase;
+    // empty for whole phases
+    Symbol function;
+    uint32_t thread;
+    int64_t start_us;
+    int64_t wall_us;
+    int64_t cpu_us;
+    uint64_t allocations;
+    uint64_t allocated_bytes;
+    // of the process, when the scope ended
+    int64_t peak_rss_kb;
+  };
+
+  TimeReport();
+  TimeReport(const TimeReport&) = delete;
+  TimeReport& operator=(const TimeReport&) = delete;
+
+  // the report scopes record into, null when none is
+  static TimeReport* active();
+  // only while no scope is open, on any thread; counts allocations while
+  // report is set
+  static void activate(TimeReport* report);
+
+  // thread safe, copies the name of the event's function
+  void record(const Event& event);
+  // microseconds since the report began
+  int64_t now_us() const;
+
+  // phases in the order they first ran, then the slowest functions
+  void write_table(FILE* out) const;
+  // Chrome trace events, for chrome://tracing or Perfetto
+  void write_trace(const std::string& file_name) const;
+
+ private:
+  std::chrono::steady_clock::time_point start_;
+  mutable std::mutex mutex_;
+  std::vector<Event> events_;
+  // names of the functions in events_
+  SymbolTable functions_;
+};
+
+// Times its lifetime into the active report as phase, of function if set.
+// Nested scopes are counted in the enclosing ones too.
+class TimeScope {
+ public:
+  explicit TimeScope(const char* phase, Symbol function = {})
+      : report_{TimeReport::active()} {
+    if (report_) begin(phase, function);
+  }
+  ~TimeScope() {
+    if (report_) end();
+  }
+  TimeScope(const TimeScope&) = delete;
+  TimeScope& operator=(const TimeScope&) = delete;
+
+ private:
+  TimeReport* report_;
+  TimeReport::Event event_;
+
+  void begin(const char* phase, Symbol function);
+  void end();
+};
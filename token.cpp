@@ -4,17 +4,20 @@
 
 Token::Token(Kind kind) : kind_{kind} {}
 
-Token::Token(Kind kind, const std::string& lexeme)
+Token::Token(Kind kind, std::string_view lexeme)
     : kind_{kind}, lexeme_{lexeme} {}
 
-Token::Token(Kind kind, const std::string& lexeme, int int_value)
+Token::Token(Kind kind, std::string_view lexeme, int int_value)
     : kind_{kind}, lexeme_{lexeme}, int_value_{int_value} {}
 
+Token::Token(Kind kind, std::string_view lexeme, Symbol symbol)
+    : kind_{kind}, lexeme_{lexeme}, symbol_{symbol} {}
+
 Token::Kind Token::kind() const {
   return kind_;
 }
 
-const std::string& Token::lexeme() const {
+std::string_view Token::lexeme() const {
   return lexeme_;
 }
 
@@ -22,6 +25,10 @@ int Token::int_value() const {
   return int_value_;
 }
 
+Symbol Token::symbol() const {
+  return symbol_;
+}
+
 std::string Token::as_string() const {
   std::string str = KindNames[(size_t)kind_];
   switch (kind_) {
@@ -31,7 +38,7 @@ std::string Token::as_string() const {
     case Kind::Identifier:
     case Kind::Comment:
     case Kind::Unknown:
-      str += '(' + lexeme_ + ')';
+      str += '(' + std::string(lexeme_) + ')';
       break;
   }
   return str;
@@ -2,6 +2,9 @@
 
 #include <iosfwd>
 #include <string>
+#include <string_view>
+
+#include "symbol.h"
 
 class Token {
  public:
@@ -41,36 +44,49 @@ class Token {
     Extern,
     If,
     Else,
+    While,
+    For,
     Identifier,
     // separators
     LeftParen,
     RightParen,
     LeftBrace,
     RightBrace,
+    LeftBracket,
+    RightBracket,
     Comma,
     Semicolon,
+    // attributes
+    At,
     // misc
     Comment,
     Unknown,
   };
   inline static const std::string KindNames[] = {
-      "Eof",        "Not",       "Plus",       "Minus",      "Star",
-      "Slash",      "Remainder", "Equals",     "Ampersand",  "Pipe",
-      "Caret",      "Tilde",     "LeftShift",  "RightShift", "And",
-      "Or",         "Eq",        "Ne",         "Lt",         "Le",
-      "Gt",         "Ge",        "IntLiteral", "Let",        "Def",
-      "Extern",     "If",        "Else",       "Identifier", "LeftParen",
-      "RightParen", "LeftBrace", "RightBrace", "Comma",      "Semicolon",
-      "Comment",    "Unknown",
+      "Eof",          "Not",          "Plus",         "Minus",
+      "Star",         "Slash",        "Remainder",    "Equals",
+      "Ampersand",    "Pipe",         "Caret",        "Tilde",
+      "LeftShift",    "RightShift",   "And",          "Or",
+      "Eq",           "Ne",           "Lt",           "Le",
+      "Gt",           "Ge",           "IntLiteral",   "Let",
+      "Def",          "Extern",       "If",           "Else",
+      "While",        "For",          "Identifier",   "LeftParen",
+      "RightParen",   "LeftBrace",    "RightBrace",   "LeftBracket",
+      "RightBracket", "Comma",        "Semicolon",    "At",
+      "Comment",      "Unknown",
   };
 
   Token(Kind kind);
-  Token(Kind kind, const std::string& lexeme);
-  Token(Kind kind, const std::string& lexeme, int int_value);
+  Token(Kind kind, std::string_view lexeme);
+  Token(Kind kind, std::string_view lexeme, int int_value);
+  Token(Kind kind, std::string_view lexeme, Symbol symbol);
 
   Kind kind() const;
-  const std::string& lexeme() const;
+  // points into the tokenizer's source buffer, which must outlive the token
+  std::string_view lexeme() const;
   int int_value() const;
+  // interned name of an identifier
+  Symbol symbol() const;
   std::string as_string() const;
 
   explicit operator bool() const;
@@ -79,6 +95,7 @@ class Token {
 
  private:
   Kind kind_;
-  std::string lexeme_;
-  int int_value_;
+  std::string_view lexeme_;
+  int int_value_{0};
+  Symbol symbol_{};
 };
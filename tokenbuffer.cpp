@@ -0,0 +1,91 @@
+#include <algorithm>
+#include <cstring>
+
+#include "fmt.h"
+#include "timereport.h"
+#include "tokenbuffer.h"
+
+TokenBuffer::TokenBuffer(const std::string& file_name, SymbolTable& symbols)
+    : TokenBuffer{SourceBuffer::from_file(file_name), symbols} {}
+
+TokenBuffer::TokenBuffer(SourceBuffer source, SymbolTable& symbols)
+    : tokenizer_{std::move(source), symbols}, symbols_{symbols} {
+  TimeScope timing{"lex"};
+  const SourceBuffer& buffer = tokenizer_.source();
+  if (buffer.size() > UINT32_MAX) error("source file is too large");
+  // a rough guess to avoid most regrowth, tokens average a few bytes
+  tokens_.reserve(buffer.size() / 4 + 1);
+  while (Token token = tokenizer_.next_token()) {
+    int32_t value = token.kind() == Token::Kind::Identifier
+                        ? static_cast<int32_t>(token.symbol().id())
+                        : token.int_value();
+    tokens_.push_back({
+        static_cast<uint32_t>(token.lexeme().data() - buffer.data()),
+        static_cast<uint32_t>(token.lexeme().size()),
+        value,
+        token.kind(),
+    });
+  }
+  tokens_.shrink_to_fit();
+}
+
+Token TokenBuffer::peek(size_t k) const {
+  return expand(pos_ + k);
+}
+
+Token TokenBuffer::next_token() {
+  cur_token_ = expand(pos_);
+  if (pos_ < tokens_.size()) ++pos_;
+  return cur_token_;
+}
+
+const Token& TokenBuffer::cur_token() const {
+  return cur_token_;
+}
+
+int TokenBuffer::line() const {
+  uint32_t offset = pos_ > 0 ? tokens_[pos_ - 1].offset : 0;
+  if (cur_token_.kind() == Token::Kind::Eof)
+    offset = tokenizer_.source().size();
+  return line_at(offset);
+}
+
+int TokenBuffer::line(const Token& token) const {
+  const SourceBuffer& buffer = tokenizer_.source();
+  auto lexeme = reinterpret_cast<uintptr_t>(token.lexeme().data());
+  auto begin = reinterpret_cast<uintptr_t>(buffer.data());
+  // Eof has no lexeme in the buffer, and is reported at its end
+  if (token.kind() == Token::Kind::Eof || lexeme < begin ||
+      lexeme > begin + buffer.size())
+    return line_at(buffer.size());
+  return line_at(lexeme - begin);
+}
+
+int TokenBuffer::line_at(uint32_t offset) const {
+  const SourceBuffer& buffer = tokenizer_.source();
+  if (line_starts_.empty()) {
+    line_starts_.push_back(0);
+    const char* begin = buffer.data();
+    const char* end = begin + buffer.size();
+    for (const char* p = begin;
+         (p = static_cast<const char*>(memchr(p, '\n', end - p))); ++p) {
+      line_starts_.push_back(p + 1 - begin);
+    }
+  }
+  auto it = std::upper_bound(line_starts_.begin(), line_starts_.end(), offset);
+  return it - line_starts_.begin() + buffer.first_line() - 1;
+}
+
+size_t TokenBuffer::size() const {
+  return tokens_.size();
+}
+
+Token TokenBuffer::expand(size_t index) const {
+  if (index >= tokens_.size()) return Token::Kind::Eof;
+  const CompactToken& token = tokens_[index];
+  std::string_view lexeme{tokenizer_.source().data() + token.offset,
+                          token.length};
+  if (token.kind == Token::Kind::Identifier)
+    return Token(token.kind, lexeme, symbols_.symbol(token.value));
+  return Token(token.kind, lexeme, token.value);
+}
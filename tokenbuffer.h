@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "tokenizer.h"
+
+// A whole file lexed up front into a flat array of compact tokens, giving
+// the parser O(1) lookahead of any distance without putback.
+class TokenBuffer {
+ public:
+  // identifiers are interned into symbols, which must outlive the tokens
+  TokenBuffer(const std::string& file_name, SymbolTable& symbols);
+  TokenBuffer(SourceBuffer source, SymbolTable& symbols);
+
+  // the k-th token after the current one, Eof past the end
+  Token peek(size_t k = 0) const;
+  Token next_token();
+  const Token& cur_token() const;
+
+  // line of the current token
+  int line() const;
+  // line of a token from this buffer, peeked or consumed
+  int line(const Token& token) const;
+  size_t size() const;
+
+ private:
+  struct CompactToken {
+    uint32_t offset;
+    uint32_t length;
+    // value of an integer literal, or symbol id of an identifier
+    int32_t value;
+    Token::Kind kind;
+  };
+  static_assert(sizeof(CompactToken) <= 16);
+
+  Tokenizer tokenizer_;
+  SymbolTable& symbols_;
+  std::vector<CompactToken> tokens_;
+  size_t pos_{0};
+  Token cur_token_{Token::Kind::Unknown};
+  // offsets of line starts, only built when a line number is needed
+  mutable std::vector<uint32_t> line_starts_;
+
+  Token expand(size_t index) const;
+  int line_at(uint32_t offset) const;
+};
@@ -1,67 +1,204 @@
-#include <unordered_map>
-#include <vector>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "fmt.h"
 #include "tokenizer.h"
 
-Tokenizer::Tokenizer(const std::string& file_name)
-    : file_{file_name, std::ios::binary} {
-  if (!file_) error("could not open file");
+Tokenizer::Tokenizer(const std::string& file_name, SymbolTable& symbols)
+    : Tokenizer{SourceBuffer::from_file(file_name), symbols} {}
+
+Tokenizer::Tokenizer(SourceBuffer source, SymbolTable& symbols)
+    : source_{std::move(source)},
+      symbols_{symbols},
+      pos_{source_.data()},
+      end_{source_.data() + source_.size()},
+      line_{source_.first_line()} {}
+
+namespace {
+
+// character classes, independent of the current locale
+enum CharClass : uint8_t {
+  Space = 1 << 0,
+  Digit = 1 << 1,
+  IdentStart = 1 << 2,
+  IdentRest = 1 << 3,
+};
+
+constexpr std::array<uint8_t, 256> make_char_classes() {
+  std::array<uint8_t, 256> classes{};
+  for (char c : {' ', '\t', '\n', '\v', '\f', '\r'}) classes[c] = Space;
+  for (int c = '0'; c <= '9'; ++c) classes[c] = Digit | IdentRest;
+  for (int c = 'a'; c <= 'z'; ++c) classes[c] = IdentStart | IdentRest;
+  for (int c = 'A'; c <= 'Z'; ++c) classes[c] = IdentStart | IdentRest;
+  classes['_'] = IdentStart | IdentRest;
+  return classes;
 }
 
-Tokenizer::~Tokenizer() {
-  file_.close();
+constexpr std::array<Token::Kind, 256> make_single_char_kinds() {
+  std::array<Token::Kind, 256> kinds{};
+  kinds.fill(Token::Kind::Unknown);
+  kinds['!'] = Token::Kind::Not;
+  kinds['+'] = Token::Kind::Plus;
+  kinds['-'] = Token::Kind::Minus;
+  kinds['*'] = Token::Kind::Star;
+  kinds['/'] = Token::Kind::Slash;
+  kinds['%'] = Token::Kind::Remainder;
+  kinds['='] = Token::Kind::Equals;
+  kinds['&'] = Token::Kind::Ampersand;
+  kinds['|'] = Token::Kind::Pipe;
+  kinds['^'] = Token::Kind::Caret;
+  kinds['~'] = Token::Kind::Tilde;
+  kinds['<'] = Token::Kind::Lt;
+  kinds['>'] = Token::Kind::Gt;
+  kinds['('] = Token::Kind::LeftParen;
+  kinds[')'] = Token::Kind::RightParen;
+  kinds['{'] = Token::Kind::LeftBrace;
+  kinds['}'] = Token::Kind::RightBrace;
+  kinds['['] = Token::Kind::LeftBracket;
+  kinds[']'] = Token::Kind::RightBracket;
+  kinds[','] = Token::Kind::Comma;
+  kinds[';'] = Token::Kind::Semicolon;
+  kinds['@'] = Token::Kind::At;
+  return kinds;
 }
 
+constexpr std::array<uint8_t, 256> char_classes = make_char_classes();
+constexpr std::array<Token::Kind, 256> single_char_kinds =
+    make_single_char_kinds();
+
+inline bool has_class(char c, uint8_t cls) {
+  return char_classes[static_cast<unsigned char>(c)] & cls;
+}
+
+struct Keyword {
+  std::string_view lexeme;
+  Token::Kind kind;
+};
+
+// perfect hash over the keyword set, checked below
+constexpr size_t keyword_hash(std::string_view lexeme) {
+  return (lexeme.size() * 2 + static_cast<unsigned char>(lexeme.front()) +
+          static_cast<unsigned char>(lexeme.back()) * 2) &
+         7;
+}
+
+constexpr Keyword keywords[] = {
+    {"let", Token::Kind::Let}, {"def", Token::Kind::Def},
+    {"extern", Token::Kind::Extern}, {"if", Token::Kind::If},
+    {"else", Token::Kind::Else}, {"while", Token::Kind::While},
+    {"for", Token::Kind::For},
+};
+
+constexpr bool keyword_hash_is_perfect() {
+  bool used[8] = {};
+  for (const Keyword& keyword : keywords) {
+    size_t slot = keyword_hash(keyword.lexeme);
+    if (used[slot]) return false;
+    used[slot] = true;
+  }
+  return true;
+}
+static_assert(keyword_hash_is_perfect(),
+              "keywords collide in keyword_hash, pick another hash");
+
+constexpr std::array<Keyword, 8> make_keyword_table() {
+  std::array<Keyword, 8> table{};
+  for (const Keyword& keyword : keywords) {
+    table[keyword_hash(keyword.lexeme)] = keyword;
+  }
+  return table;
+}
+
+constexpr std::array<Keyword, 8> keyword_table = make_keyword_table();
+
+#if defined(__AVX2__)
+// 32 byte blocks; bit i of a mask is set when byte i matches
+struct Block {
+  static constexpr size_t width = 32;
+  __m256i v;
+  static Block load(const char* p) {
+    return {_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p))};
+  }
+  uint32_t eq(char c) const {
+    return _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(c)));
+  }
+  // bytes in [lo, hi], using signed compares, so only valid for ASCII bounds
+  uint32_t in_range(char lo, char hi) const {
+    __m256i ge = _mm256_cmpgt_epi8(v, _mm256_set1_epi8(lo - 1));
+    __m256i le = _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), v);
+    return _mm256_movemask_epi8(_mm256_and_si256(ge, le));
+  }
+};
+#define CATA_SIMD_LEXER 1
+#elif defined(__SSE2__)
+struct Block {
+  static constexpr size_t width = 16;
+  __m128i v;
+  static Block load(const char* p) {
+    return {_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))};
+  }
+  uint32_t eq(char c) const {
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(c)));
+  }
+  uint32_t in_range(char lo, char hi) const {
+    __m128i ge = _mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1));
+    __m128i le = _mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1));
+    return _mm_movemask_epi8(_mm_and_si128(ge, le));
+  }
+};
+#define CATA_SIMD_LEXER 1
+#endif
+
+}  // namespace
+
 static Token::Kind get_single_char_kind(char c) {
-  static const std::unordered_map<char, Token::Kind> single_char_tokens = {
-      {'!', Token::Kind::Not},        {'+', Token::Kind::Plus},
-      {'-', Token::Kind::Minus},      {'*', Token::Kind::Star},
-      {'/', Token::Kind::Slash},      {'%', Token::Kind::Remainder},
-      {'=', Token::Kind::Equals},     {'&', Token::Kind::Ampersand},
-      {'|', Token::Kind::Pipe},       {'^', Token::Kind::Caret},
-      {'~', Token::Kind::Tilde},      {'<', Token::Kind::Lt},
-      {'>', Token::Kind::Gt},         {'(', Token::Kind::LeftParen},
-      {')', Token::Kind::RightParen}, {'{', Token::Kind::LeftBrace},
-      {'}', Token::Kind::RightBrace}, {',', Token::Kind::Comma},
-      {';', Token::Kind::Semicolon},
-  };
-  auto it = single_char_tokens.find(c);
-  if (it == single_char_tokens.end()) return Token::Kind::Unknown;
-  return it->second;
+  return single_char_kinds[static_cast<unsigned char>(c)];
 }
 
 static Token::Kind get_double_char_kind(Token::Kind kind, char c) {
-  static const std::unordered_map<Token::Kind,
-                                  std::unordered_map<char, Token::Kind>>
-      double_char_tokens = {
-          {Token::Kind::Slash,
-           {{'/', Token::Kind::Comment}, {'*', Token::Kind::Comment}}},
-          {Token::Kind::Lt,
-           {{'<', Token::Kind::LeftShift}, {'=', Token::Kind::Le}}},
-          {Token::Kind::Gt,
-           {{'>', Token::Kind::RightShift}, {'=', Token::Kind::Ge}}},
-          {Token::Kind::Equals, {{'=', Token::Kind::Eq}}},
-          {Token::Kind::Not, {{'=', Token::Kind::Ne}}},
-          {Token::Kind::Ampersand, {{'&', Token::Kind::And}}},
-          {Token::Kind::Pipe, {{'|', Token::Kind::Or}}},
-      };
-  auto it = double_char_tokens.find(kind);
-  if (it == double_char_tokens.end()) return Token::Kind::Unknown;
-  auto it2 = it->second.find(c);
-  if (it2 == it->second.end()) return Token::Kind::Unknown;
-  return it2->second;
-}
-
-static Token::Kind get_keyword_kind(const std::string& lexeme) {
-  static const std::unordered_map<std::string, Token::Kind> keywords = {
-      {"let", Token::Kind::Let},       {"def", Token::Kind::Def},
-      {"extern", Token::Kind::Extern}, {"if", Token::Kind::If},
-      {"else", Token::Kind::Else},
-  };
-  auto it = keywords.find(lexeme);
-  if (it == keywords.end()) return Token::Kind::Unknown;
-  return it->second;
+  switch (kind) {
+    case Token::Kind::Slash:
+      if (c == '/' || c == '*') return Token::Kind::Comment;
+      break;
+    case Token::Kind::Lt:
+      if (c == '<') return Token::Kind::LeftShift;
+      if (c == '=') return Token::Kind::Le;
+      break;
+    case Token::Kind::Gt:
+      if (c == '>') return Token::Kind::RightShift;
+      if (c == '=') return Token::Kind::Ge;
+      break;
+    case Token::Kind::Equals:
+      if (c == '=') return Token::Kind::Eq;
+      break;
+    case Token::Kind::Not:
+      if (c == '=') return Token::Kind::Ne;
+      break;
+    case Token::Kind::Ampersand:
+      if (c == '&') return Token::Kind::And;
+      break;
+    case Token::Kind::Pipe:
+      if (c == '|') return Token::Kind::Or;
+      break;
+    default:
+      break;
+  }
+  return Token::Kind::Unknown;
+}
+
+static Token::Kind get_keyword_kind(std::string_view lexeme) {
+  const Keyword& keyword = keyword_table[keyword_hash(lexeme)];
+  if (keyword.lexeme != lexeme) return Token::Kind::Unknown;
+  return keyword.kind;
 }
 
 Token Tokenizer::next_token(bool keep_comment) {
@@ -88,12 +225,12 @@ int Tokenizer::line() const {
   return line_;
 }
 
-std::string Tokenizer::peek(int n) {
-  int pos = file_.tellg();
-  std::vector<char> buffer(n);
-  file_.read(buffer.data(), n);
-  file_.seekg(pos);
-  return std::string(buffer.begin(), buffer.end());
+const SourceBuffer& Tokenizer::source() const {
+  return source_;
+}
+
+std::string_view Tokenizer::peek(int n) const {
+  return {pos_, std::min<size_t>(n, end_ - pos_)};
 }
 
 Token Tokenizer::next_token_internal() {
@@ -103,67 +240,100 @@ Token Tokenizer::next_token_internal() {
     return token;
   }
   skip_whitespace();
-  char c;
-  file_.get(c);
-  if (!file_) return Token::Kind::Eof;
+  if (pos_ == end_) return Token::Kind::Eof;
+  const char* start = pos_;
+  char c = *pos_++;
   Token::Kind kind = get_single_char_kind(c);
   if (kind != Token::Kind::Unknown) {
-    Token::Kind double_kind = get_double_char_kind(kind, file_.peek());
+    Token::Kind double_kind =
+        get_double_char_kind(kind, pos_ != end_ ? *pos_ : '\0');
     if (double_kind == Token::Kind::Unknown)
-      return Token(kind, std::string(1, c));
-    std::string lexeme = std::string(1, c) + (char)file_.get();
+      return Token(kind, std::string_view(start, 1));
+    ++pos_;
     if (double_kind == Token::Kind::Comment) {
-      if (lexeme == "//") {
-        std::getline(file_, lexeme);
-      } else {
-        // block comment
-        lexeme.clear();
-        while (true) {
-          if (file_.get(c) && c == '*' && file_.peek() == '/') {
-            file_.get(c);
-            break;
-          }
-          if (!file_)
-            error_expected((*this), Token(Token::Kind::Comment, "EOF"), "*/");
-          lexeme += c;
-        }
+      if (start[1] == '/') {
+        // the newline is left for skip_whitespace so it is counted
+        const char* eol =
+            static_cast<const char*>(memchr(pos_, '\n', end_ - pos_));
+        start = pos_;
+        pos_ = eol ? eol : end_;
+        return Token(Token::Kind::Comment,
+                     std::string_view(start, pos_ - start));
       }
+      // block comment
+      start = pos_;
+      skip_block_comment();
+      std::string_view lexeme(start, pos_ - start);
+      pos_ += 2;
       return Token(Token::Kind::Comment, lexeme);
     }
-    return Token(double_kind, lexeme);
-  }
-  if (isdigit(c)) {
-    file_.putback(c);
-    std::string lexeme;
-    int int_value = 0;
-    while (isdigit(file_.peek())) {
-      file_.get(c);
-      lexeme += c;
-      int_value = int_value * 10 + (c - '0');
-    }
-    return Token(Token::Kind::IntLiteral, lexeme, int_value);
+    return Token(double_kind, std::string_view(start, 2));
   }
-  if (isalpha(c) || c == '_') {
-    std::string lexeme{c};
-    while (isalnum(file_.peek()) || file_.peek() == '_') {
-      file_.get(c);
-      lexeme += c;
+  if (has_class(c, Digit)) {
+    int int_value = c - '0';
+    while (pos_ != end_ && has_class(*pos_, Digit)) {
+      int_value = int_value * 10 + (*pos_++ - '0');
     }
+    return Token(Token::Kind::IntLiteral, std::string_view(start, pos_ - start),
+                 int_value);
+  }
+  if (has_class(c, IdentStart)) {
+    while (pos_ != end_ && has_class(*pos_, IdentRest)) ++pos_;
+    std::string_view lexeme(start, pos_ - start);
     Token::Kind kind = get_keyword_kind(lexeme);
     if (kind != Token::Kind::Unknown) return Token(kind, lexeme);
-    return Token(Token::Kind::Identifier, lexeme);
+    return Token(Token::Kind::Identifier, lexeme, symbols_.intern(lexeme));
   }
   error("unknown character: %d", (int)c);
-  return Token(Token::Kind::Unknown, std::string(1, c));
+  return Token(Token::Kind::Unknown, std::string_view(start, 1));
 }
 
 void Tokenizer::skip_whitespace() {
-  char c;
-  while (file_.get(c)) {
-    if (!isspace(c)) {
-      file_.putback(c);
-      break;
+#ifdef CATA_SIMD_LEXER
+  while (static_cast<size_t>(end_ - pos_) >= Block::width) {
+    Block block = Block::load(pos_);
+    uint32_t newlines = block.eq('\n');
+    // '\t' '\n' '\v' '\f' '\r' are contiguous
+    uint32_t spaces = block.eq(' ') | block.in_range('\t', '\r');
+    uint32_t rest = ~spaces;
+    if constexpr (Block::width < 32) rest &= (1u << Block::width) - 1;
+    if (rest) {
+      int n = std::countr_zero(rest);
+      line_ += std::popcount(newlines & ((1u << n) - 1));
+      pos_ += n;
+      return;
+    }
+    line_ += std::popcount(newlines);
+    pos_ += Block::width;
+  }
+#endif
+  while (pos_ != end_ && has_class(*pos_, Space)) {
+    if (*pos_++ == '\n') ++line_;
+  }
+}
+
+// Advances pos_ to the "*/" closing the current block comment.
+void Tokenizer::skip_block_comment() {
+#ifdef CATA_SIMD_LEXER
+  // the second load reads one byte ahead to match '/' after '*'
+  while (static_cast<size_t>(end_ - pos_) >= Block::width + 1) {
+    Block block = Block::load(pos_);
+    uint32_t newlines = block.eq('\n');
+    uint32_t close = block.eq('*') & Block::load(pos_ + 1).eq('/');
+    if (close) {
+      int n = std::countr_zero(close);
+      line_ += std::popcount(newlines & ((1u << n) - 1));
+      pos_ += n;
+      return;
     }
-    if (c == '\n') ++line_;
+    line_ += std::popcount(newlines);
+    pos_ += Block::width;
+  }
+#endif
+  while (true) {
+    if (end_ - pos_ < 2)
+      error("in line %d: expected */ (got end of file)", line_);
+    if (pos_[0] == '*' && pos_[1] == '/') return;
+    if (*pos_++ == '\n') ++line_;
   }
 }
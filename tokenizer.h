@@ -1,29 +1,36 @@
 #pragma once
 
-#include <fstream>
 #include <optional>
 #include <string>
+#include <string_view>
 
+#include "source.h"
 #include "token.h"
 
 class Tokenizer {
  public:
-  Tokenizer(const std::string& file_name);
-  ~Tokenizer();
+  // identifiers are interned into symbols, which must outlive the tokens
+  Tokenizer(const std::string& file_name, SymbolTable& symbols);
+  Tokenizer(SourceBuffer source, SymbolTable& symbols);
 
   Token next_token(bool keep_comment = false);
   const Token& cur_token() const;
   void putback(const Token& token);
 
   int line() const;
+  const SourceBuffer& source() const;
 
  private:
-  std::ifstream file_;
+  SourceBuffer source_;
+  SymbolTable& symbols_;
+  const char* pos_;
+  const char* end_;
   int line_{1};
   Token cur_token_{Token::Kind::Unknown};
   std::optional<Token> putback_{};
 
-  std::string peek(int n);
+  std::string_view peek(int n) const;
   Token next_token_internal();
   void skip_whitespace();
+  void skip_block_comment();
 };
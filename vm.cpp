@@ -0,0 +1,267 @@
+#include <algorithm>
+#include <climits>
+
+#include "fmt.h"
+#include "runtime.h"
+#include "vm.h"
+
+// computed goto where the compiler has it, a switch elsewhere
+#if defined(__GNUC__)
+#define CATA_THREADED_DISPATCH 1
+#endif
+
+VM::VM(const BytecodeProgram& program) : program_{program} {}
+
+int VM::run_main() {
+  auto it = std::ranges::find_if(program_.functions, [](const auto& function) {
+    return function.name.str() == "main";
+  });
+  if (it == program_.functions.end())
+    error("called undefined function, main");
+  return call(it - program_.functions.begin(), {});
+}
+
+int VM::call(uint32_t index, std::span<const int> args) {
+  const BytecodeFunction& function = program_.functions[index];
+  if (function.arg_count != args.size())
+    error("function %s expects %u arguments, but got %lu",
+          function.name.str().c_str(), function.arg_count, args.size());
+  stack_.resize(std::max<size_t>(stack_.size(), function.frame_size));
+  std::copy(args.begin(), args.end(), stack_.begin());
+  frames_.clear();
+  return execute(program_.code.data() + function.entry);
+}
+
+static int divide(int lhs, int rhs, bool remainder) {
+  if (rhs == 0) error("division by zero");
+  if (lhs == INT_MIN && rhs == -1) return remainder ? 0 : INT_MIN;
+  return remainder ? lhs % rhs : lhs / rhs;
+}
+
+int VM::execute(const BytecodeInstruction* pc) {
+  const BytecodeInstruction* const code = program_.code.data();
+  const BytecodeFunction* const functions = program_.functions.data();
+  size_t base = 0;
+  int* r = stack_.data();
+  uint32_t callee;
+
+#define A r[pc->a]
+#define B r[pc->b]
+#define C r[pc->c]
+// arithmetic wraps like the generated code
+#define U(x) static_cast<unsigned>(x)
+
+#ifdef CATA_THREADED_DISPATCH
+  static const void* const dispatch[] = {
+#define CATA_OPCODE_LABEL(name) &&op_##name,
+      CATA_OPCODES(CATA_OPCODE_LABEL)
+#undef CATA_OPCODE_LABEL
+  };
+#define CASE(name) op_##name:
+#define DISPATCH() goto* dispatch[static_cast<size_t>(pc->op)]
+#else
+#define CASE(name) case Opcode::name:
+#define DISPATCH() goto dispatch
+#endif
+#define NEXT() \
+  ++pc;        \
+  DISPATCH()
+#define JUMP(target)     \
+  pc = code + (target); \
+  DISPATCH()
+#define BRANCH_UNLESS(cond) \
+  if (cond) {               \
+    NEXT();                 \
+  }                         \
+  JUMP(pc->imm)
+
+#ifdef CATA_THREADED_DISPATCH
+  DISPATCH();
+#else
+dispatch:
+  switch (pc->op) {
+#endif
+  CASE(LoadConst) {
+    A = pc->imm;
+    NEXT();
+  }
+  CASE(Move) {
+    A = B;
+    NEXT();
+  }
+  CASE(Add) {
+    A = U(B) + U(C);
+    NEXT();
+  }
+  CASE(AddImm) {
+    A = U(B) + U(pc->imm);
+    NEXT();
+  }
+  CASE(Sub) {
+    A = U(B) - U(C);
+    NEXT();
+  }
+  CASE(Mul) {
+    A = U(B) * U(C);
+    NEXT();
+  }
+  CASE(Div) {
+    A = divide(B, C, false);
+    NEXT();
+  }
+  CASE(Rem) {
+    A = divide(B, C, true);
+    NEXT();
+  }
+  CASE(And) {
+    A = B & C;
+    NEXT();
+  }
+  CASE(Or) {
+    A = B | C;
+    NEXT();
+  }
+  CASE(Xor) {
+    A = B ^ C;
+    NEXT();
+  }
+  // shift amounts past the width are poison in IR, use the hardware's
+  CASE(Shl) {
+    A = U(B) << (C & 31);
+    NEXT();
+  }
+  CASE(Shr) {
+    A = B >> (C & 31);
+    NEXT();
+  }
+  CASE(Eq) {
+    A = B == C;
+    NEXT();
+  }
+  CASE(Ne) {
+    A = B != C;
+    NEXT();
+  }
+  CASE(Lt) {
+    A = B < C;
+    NEXT();
+  }
+  CASE(Le) {
+    A = B <= C;
+    NEXT();
+  }
+  CASE(Gt) {
+    A = B > C;
+    NEXT();
+  }
+  CASE(Ge) {
+    A = B >= C;
+    NEXT();
+  }
+  CASE(Not) {
+    A = B == 0;
+    NEXT();
+  }
+  CASE(Neg) {
+    A = -U(B);
+    NEXT();
+  }
+  CASE(BitNot) {
+    A = ~B;
+    NEXT();
+  }
+  CASE(Jump) {
+    JUMP(pc->imm);
+  }
+  CASE(JumpIfZero) {
+    BRANCH_UNLESS(B != 0);
+  }
+  CASE(JumpUnlessEq) {
+    BRANCH_UNLESS(B == C);
+  }
+  CASE(JumpUnlessNe) {
+    BRANCH_UNLESS(B != C);
+  }
+  CASE(JumpUnlessLt) {
+    BRANCH_UNLESS(B < C);
+  }
+  CASE(JumpUnlessLe) {
+    BRANCH_UNLESS(B <= C);
+  }
+  CASE(JumpUnlessGt) {
+    BRANCH_UNLESS(B > C);
+  }
+  CASE(JumpUnlessGe) {
+    BRANCH_UNLESS(B >= C);
+  }
+  // the constant is a signed 16 bit c
+  CASE(JumpUnlessEqImm) {
+    BRANCH_UNLESS(B == static_cast<int16_t>(pc->c));
+  }
+  CASE(JumpUnlessNeImm) {
+    BRANCH_UNLESS(B != static_cast<int16_t>(pc->c));
+  }
+  CASE(JumpUnlessLtImm) {
+    BRANCH_UNLESS(B < static_cast<int16_t>(pc->c));
+  }
+  CASE(JumpUnlessLeImm) {
+    BRANCH_UNLESS(B <= static_cast<int16_t>(pc->c));
+  }
+  CASE(JumpUnlessGtImm) {
+    BRANCH_UNLESS(B > static_cast<int16_t>(pc->c));
+  }
+  CASE(JumpUnlessGeImm) {
+    BRANCH_UNLESS(B >= static_cast<int16_t>(pc->c));
+  }
+  CASE(Call) {
+    callee = pc->imm;
+    goto call;
+  }
+  CASE(CallAddImm) {
+    A = U(B) + U(static_cast<int16_t>(pc->c));
+    callee = pc->imm;
+    goto call;
+  }
+  CASE(CallRuntime) {
+    A = call_native(runtime_functions[pc->imm].address, {&A, pc->b});
+    NEXT();
+  }
+  CASE(Undefined) {
+    error("called undefined function, %s",
+          functions[pc->imm].name.str().c_str());
+  }
+  CASE(Ret) {
+    int value = B;
+    if (frames_.empty()) return value;
+    // the caller's result register is the first of our frame
+    r[0] = value;
+    base = frames_.back().base;
+    pc = frames_.back().return_pc;
+    frames_.pop_back();
+    r = stack_.data() + base;
+    DISPATCH();
+  }
+#ifndef CATA_THREADED_DISPATCH
+  }
+  error("invalid opcode %d", static_cast<int>(pc->op));
+#endif
+
+call:
+  frames_.push_back({pc + 1, base});
+  base += pc->a;
+  if (base + functions[callee].frame_size > stack_.size())
+    stack_.resize(std::max(stack_.size() * 2,
+                           base + functions[callee].frame_size));
+  r = stack_.data() + base;
+  JUMP(functions[callee].entry);
+
+#undef A
+#undef B
+#undef C
+#undef U
+#undef CASE
+#undef DISPATCH
+#undef NEXT
+#undef JUMP
+#undef BRANCH_UNLESS
+}
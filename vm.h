@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "bytecode.h"
+
+// Runs bytecode on a threaded dispatch loop. Needs nothing from LLVM, so
+// programs can run where no JIT is available.
+class VM {
+ public:
+  // the program must outlive the VM
+  VM(const BytecodeProgram& program);
+
+  int run_main();
+  int call(uint32_t function, std::span<const int> args);
+
+ private:
+  struct Frame {
+    const BytecodeInstruction* return_pc;
+    size_t base;
+  };
+
+  const BytecodeProgram& program_;
+  // registers of every active call; a callee's frame starts at the
+  // caller's argument registers, so arguments are never copied
+  std::vector<int> stack_;
+  std::vector<Frame> frames_;
+
+  int execute(const BytecodeInstruction* pc);
+};